@@ -0,0 +1,179 @@
+#!/bin/sh
+# Runs the same headless workload under each dwl binary given and prints the
+# statistics dwl reports for it (see SIGUSR1 in dwl(1)), then the CPU time of
+# each run relative to the first. Used by "make pgo", both to train and to
+# measure the result.
+#
+# The workload is dwl-loadgen windows committing, changing titles and being
+# opened and closed, while a generated input recording moves the pointer,
+# clicks, scrolls and switches tags and layouts. The recording ends with
+# Mod-Shift-q, so it assumes the default key bindings.
+#
+# With -o, it runs separate scenarios instead, used by "make bench": windows
+# mapped and unmapped, tag switching, layout toggles, interactive resizes and
+# a layer-shell bar committing at 120Hz. Each one resets the statistics once
+# its windows are up, runs for 4s and appends them to the results file, one
+# per line, as the scenario, the dwl binary, then the line dwl wrote, without
+# its histogram buckets:
+#
+#	tags ./dwl frame count 240 sum_us 61234 p50 256 p90 512 p99 1024
+#
+# Results of two builds can then be compared line by line.
+
+set -e
+loadgen=${LOADGEN:-$PWD/dwl-loadgen}
+results=
+while getopts o: opt; do
+	case $opt in
+	o) results=$OPTARG ;;
+	*) echo "usage: $0 [-o results file] [dwl ...]" >&2; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] || set -- ./dwl
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+# One 48-byte record per event, see InputEvent in dwl.c
+le() { # value, bytes
+	v=$1 n=$2
+	while [ "$n" -gt 0 ]; do
+		b=$((v % 256))
+		rec="$rec\\$((b / 64 * 100 + b / 8 % 8 * 10 + b % 8))"
+		v=$((v / 256)) n=$((n - 1))
+	done
+}
+event() { # time in ms, type, state, code, x and y as little-endian doubles,
+	# and the unaccelerated x and y for motions (the same as x and y)
+	rec=
+	le $(($1 * 1000000)) 8; le "$2" 2; le "$3" 2; le "$4" 4
+	if [ "$2" -eq 1 ]; then printf "$rec$5$6$5$6"; else printf "$rec$5$6$zero$zero"; fi
+}
+zero='\0\0\0\0\0\0\0\0' one='\0\0\0\0\0\0\360\77' fifteen='\0\0\0\0\0\0\56\100'
+plus8='\0\0\0\0\0\0\40\100' minus8='\0\0\0\0\0\0\40\300'
+combo() { # time in ms, keycodes to press in order and release in reverse
+	ct=$1 up=
+	shift
+	for key; do event "$ct" 0 1 "$key" $zero $zero; up="$key $up"; ct=$((ct + 1)); done
+	for key in $up; do event "$ct" 0 0 "$key" $zero $zero; ct=$((ct + 1)); done
+}
+
+nth() { # index, list
+	shift "$1"
+	echo "$1"
+}
+alt=56 shift=42
+
+export XDG_RUNTIME_DIR="$tmp" WLR_BACKENDS=headless WLR_HEADLESS_OUTPUTS=1 \
+	WLR_LIBINPUT_NO_DEVICES=1 WLR_RENDERER=pixman
+
+if [ -n "$results" ]; then
+	# Input recordings, between the reset at 1s and the dump at 5s
+	k=0
+	while [ $k -lt 60 ]; do # view tag 1 or 2, every 50ms
+		combo $((1500 + k * 50)) $alt $((2 + k % 2))
+		k=$((k + 1))
+	done >"$tmp/tags.input"
+	k=0
+	while [ $k -lt 60 ]; do # tile, monocle, floating, every 50ms
+		combo $((1500 + k * 50)) $alt "$(nth $((k % 3 + 1)) 20 50 33)"
+		k=$((k + 1))
+	done >"$tmp/layouts.input"
+	k=0
+	while [ $k -lt 12 ]; do # Mod-right button drags, every 250ms
+		t=$((1500 + k * 250))
+		if [ $((k % 2)) -eq 0 ]; then d=$plus8; else d=$minus8; fi
+		event $t 0 1 $alt $zero $zero
+		event $((t + 1)) 3 1 273 $zero $zero
+		j=0
+		while [ $j -lt 20 ]; do
+			event $((t + 5 + j * 5)) 1 0 0 "$d" "$d"
+			j=$((j + 1))
+		done
+		event $((t + 110)) 3 0 273 $zero $zero
+		event $((t + 111)) 0 0 $alt $zero $zero
+		k=$((k + 1))
+	done >"$tmp/resize.input"
+
+	# name, commands starting the clients, commands measured (4s unless
+	# they take longer)
+	scenario() {
+		cat >"$tmp/$1.workload" <<-EOF
+		exec <&-
+		$2
+		sleep 1
+		kill -USR2 \$PPID
+		$3
+		kill -USR1 \$PPID
+		sleep 1
+		kill \$PPID
+		EOF
+	}
+	windows="\"$loadgen\" -n 6 -r 60 -d 7 2>/dev/null &"
+	scenario map "" "\"$loadgen\" -n 10 -c 20 2>/dev/null; sleep 1"
+	scenario tags "$windows" "sleep 4"
+	scenario layouts "$windows" "sleep 4"
+	scenario resize "$windows" "sleep 4"
+	scenario bar "\"$loadgen\" -n 2 -r 30 -d 7 2>/dev/null &
+		\"$loadgen\" -n 0 -l 1 -r 120 -d 7 2>/dev/null &" "sleep 4"
+
+	: >"$results"
+	for dwl in "$@"; do
+		for name in map tags layouts resize bar; do
+			echo "== $name $dwl"
+			input=
+			[ ! -f "$tmp/$name.input" ] || input=$tmp/$name.input
+			"$dwl" ${input:+-R "$input"} -s ". $tmp/$name.workload" 2>"$tmp/stats" || true
+			if grep -E '^(cpu|frame|arrange|arrangelayers|map|unmap|destroy|input|memory) ' \
+					"$tmp/stats" >"$tmp/lines"; then
+				sed "s/ hist.*//; s|^|$name $dwl |" "$tmp/lines" | tee -a "$results"
+			else
+				echo "no statistics"
+			fi
+		done
+	done
+	exit
+fi
+
+# Every 100ms from 2s to 20s: a key binding (views, focus, zoom, layouts),
+# 40 pointer motions, a scroll and a click
+keys="2 11 36 28 50 36 33 20 15 3"
+k=0
+while [ $k -lt 180 ]; do
+	t=$((2000 + k * 100))
+	combo $t $alt "$(nth $((k % 10 + 1)) $keys)"
+	j=0
+	while [ $j -lt 40 ]; do
+		if [ $((k % 2)) -eq 0 ]; then d=$plus8; else d=$minus8; fi
+		event $((t + 10 + j * 2)) 1 0 0 "$d" "$d"
+		j=$((j + 1))
+	done
+	event $((t + 92)) 4 0 0 "$fifteen" "$one"
+	event $((t + 95)) 3 1 272 $zero $zero
+	event $((t + 96)) 3 0 272 $zero $zero
+	k=$((k + 1))
+done >"$tmp/input"
+combo 20500 $alt $shift 16 >>"$tmp/input"
+
+# Steady windows for 15s, churn for 14s, then ask dwl for its statistics
+# before the recording quits it
+cat >"$tmp/workload" <<EOF
+exec <&-
+"$loadgen" -n 6 -r 60 -t 20 -p 1 -l 1 -d 15 2>/dev/null &
+start=\$(date +%s)
+while [ \$((\$(date +%s) - start)) -lt 14 ]; do
+	"$loadgen" -n 2 -r 30 -d 0.3 2>/dev/null
+done
+wait
+kill -USR1 \$PPID
+EOF
+
+for dwl in "$@"; do
+	echo "== $dwl"
+	"$dwl" -R "$tmp/input" -s ". $tmp/workload" 2>"$tmp/stats" || true
+	grep -E '^(cpu|frame|arrange|input|handler|output) ' "$tmp/stats" || echo "no statistics"
+	grep '^cpu ' "$tmp/stats" | sed "s|^|$dwl |" >>"$tmp/cpu" || true
+done
+[ $# -lt 2 ] || awk '{ t = $4 + $6 } NR == 1 { first = t }
+	{ printf "%s cpu_us %d speedup %.3f\n", $1, t, t ? first / t : 0 }' "$tmp/cpu"
@@ -180,6 +180,18 @@ client_get_parent(Client *c)
 	return p;
 }
 
+static inline pid_t
+client_get_pid(Client *c)
+{
+	pid_t pid;
+#ifdef XWAYLAND
+	if (client_is_x11(c))
+		return c->surface.xwayland->pid;
+#endif
+	wl_client_get_credentials(c->surface.xdg->client->client, &pid, NULL, NULL);
+	return pid;
+}
+
 static inline const char *
 client_get_title(Client *c)
 {
@@ -224,6 +236,38 @@ client_is_float_type(Client *c)
 			|| state.min_height == state.max_height));
 }
 
+static inline int
+client_is_opaque(Client *c)
+{
+	/* Whether the window geometry of the surface is covered by its opaque
+	 * region, so it entirely hides what is behind it */
+	struct wlr_surface *surface = client_surface(c);
+	struct wlr_box geom = {0};
+#ifdef XWAYLAND
+	if (client_is_x11(c))
+		geom = (struct wlr_box){.width = surface->current.width,
+				.height = surface->current.height};
+	else
+#endif
+		wlr_xdg_surface_get_geometry(c->surface.xdg, &geom);
+
+	if (geom.width <= 0 || geom.height <= 0)
+		return 0;
+	return pixman_region32_contains_rectangle(&surface->opaque_region,
+			&(pixman_box32_t){geom.x, geom.y, geom.x + geom.width, geom.y + geom.height})
+			== PIXMAN_REGION_IN;
+}
+
+static inline int
+client_is_pinging(Client *c)
+{
+#ifdef XWAYLAND
+	if (client_is_x11(c))
+		return c->surface.xwayland->pinging;
+#endif
+	return c->surface.xdg->client->ping_serial != 0;
+}
+
 static inline int
 client_is_rendered_on_mon(Client *c, Monitor *m)
 {
@@ -245,6 +289,8 @@ client_is_stopped(Client *c)
 {
 	int pid;
 	siginfo_t in = {0};
+	if (c->frozen)
+		return 1;
 #ifdef XWAYLAND
 	if (client_is_x11(c))
 		return 0;
@@ -285,6 +331,19 @@ client_notify_enter(struct wlr_surface *s, struct wlr_keyboard *kb)
 		wlr_seat_keyboard_notify_enter(seat, s, NULL, 0, NULL);
 }
 
+static inline void
+client_ping(Client *c)
+{
+#ifdef XWAYLAND
+	/* Only does anything if the client supports _NET_WM_PING */
+	if (client_is_x11(c)) {
+		wlr_xwayland_surface_ping(c->surface.xwayland);
+		return;
+	}
+#endif
+	wlr_xdg_surface_ping(c->surface.xdg);
+}
+
 static inline void
 client_restack_surface(Client *c)
 {
@@ -10,6 +10,7 @@ static const unsigned int borderpx         = 1;  /* border pixel of windows */
 static const float bordercolor[]           = COLOR(0x444444ff);
 static const float focuscolor[]            = COLOR(0x005577ff);
 static const float urgentcolor[]           = COLOR(0xff0000ff);
+static const float unresponsivecolor[]     = COLOR(0x777777ff);
 /* To conform the xdg-protocol, set the alpha to zero to restore the old behavior */
 static const float fullscreen_bg[]         = {0.1, 0.1, 0.1, 1.0}; /* You can also use glsl colors */
 
@@ -19,12 +20,56 @@ static const float fullscreen_bg[]         = {0.1, 0.1, 0.1, 1.0}; /* You can al
 /* logging */
 static int log_level = WLR_ERROR;
 
+/* Run input devices on their own event loop, always handled before clients.
+ * This replaces the libinput backend and the main loop, and is still
+ * experimental, so it is off by default. */
+static const int input_priority = 0;
+
+/* Requests and surface commits per second a client may send before its frame
+ * callbacks, selections, cursor and activation requests are held back until the
+ * next second, 0 = no limit. Try 20000 and 2000. */
+static const unsigned int client_request_budget = 0;
+static const unsigned int client_commit_budget = 0;
+
+/* Visible clients are pinged every ping_interval ms (0 = never), those not
+ * answering within ping_timeout ms no longer hold back frames. When set, the
+ * status output has an unresponsive line per output, see dwl(1). Try 5000. */
+static const int ping_interval = 0;
+static const int ping_timeout = 3000;
+
+/* The focused client's process gets its niceness changed by focus_nice and, if
+ * it has the default I/O priority, the best-effort I/O priority focus_ioprio
+ * (0-7, -1 = don't change) until it loses focus, e.g. -5 and 2. Lowering
+ * niceness needs CAP_SYS_NICE or RLIMIT_NICE, without them only the I/O
+ * priority is set. Both are off by default. */
+static const int focus_nice = 0;
+static const int focus_ioprio = -1;
+
+/* Seconds without X11 windows or other X11 clients before Xwayland is stopped,
+ * 0 = never. It is started again by the next X11 client connecting. Values
+ * under 6 are raised to 6, wlroots doesn't restart an Xwayland that quit
+ * within 5 seconds of starting. */
+static const int xwayland_timeout = 60;
+
+/* Clients of rules with freeze set are frozen after being hidden for this many ms.
+ * dwl thaws them when it exits or crashes, but cannot if it is SIGKILLed. */
+static const int freeze_delay = 10000;
+
+/* Windows covering the others in fullscreen or monocle that become opaque or
+ * transparent get the others hidden or shown again at most once per this many
+ * ms. Only Wayland windows are followed, X11 ones only when arranged anyway. */
+static const int occlusion_interval = 250;
+
+/* Serve statistics in Prometheus text format over HTTP on the Unix socket
+ * $XDG_RUNTIME_DIR/$WAYLAND_DISPLAY.metrics, see dwl(1) */
+static const int metrics_socket = 0;
+
 static const Rule rules[] = {
-	/* app_id     title       tags mask     isfloating   monitor */
+	/* app_id     title       tags mask     isfloating   monitor   freeze   noboost */
 	/* examples:
-	{ "Gimp",     NULL,       0,            1,           -1 },
+	{ "Gimp",     NULL,       0,            1,           -1,       0,       0 },
 	*/
-	{ "firefox",  NULL,       1 << 8,       0,           -1 },
+	{ "firefox",  NULL,       1 << 8,       0,           -1,       0,       0 },
 };
 
 /* layout(s) */
@@ -54,6 +99,11 @@ static const struct xkb_rule_names xkb_rules = {
 	.options = NULL,
 };
 
+/* Cache the compiled keymap in $XDG_CACHE_HOME/dwl to speed up startup. It is
+ * rebuilt when XKB files are added, replaced or removed, or libxkbcommon is
+ * upgraded; remove the cache if you edit your own XKB files in place. */
+static const int keymap_cache = 1;
+
 static const int repeat_rate = 25;
 static const int repeat_delay = 600;
 
@@ -115,11 +165,19 @@ static const enum libinput_config_tap_button_map button_map = LIBINPUT_CONFIG_TA
 static const char *termcmd[] = { "foot", NULL };
 static const char *menucmd[] = { "bemenu-run", NULL };
 
+/* Keep count instances of these commands started and hidden, for usepool().
+ * An instance is recognised by its pid or activation token however long it
+ * takes to map, so the command must not exit before its window maps. */
+static const Pool pools[] = {
+	/* app_id     count   command */
+	{ "foot",     0,      termcmd },
+};
+
 static const Key keys[] = {
 	/* Note that Shift changes certain key codes: c -> C, 2 -> at, etc. */
 	/* modifier                  key                 function        argument */
 	{ MODKEY,                    XKB_KEY_p,          spawn,          {.v = menucmd} },
-	{ MODKEY|WLR_MODIFIER_SHIFT, XKB_KEY_Return,     spawn,          {.v = termcmd} },
+	{ MODKEY|WLR_MODIFIER_SHIFT, XKB_KEY_Return,     usepool,        {.v = termcmd} },
 	{ MODKEY,                    XKB_KEY_j,          focusstack,     {.i = +1} },
 	{ MODKEY,                    XKB_KEY_k,          focusstack,     {.i = -1} },
 	{ MODKEY,                    XKB_KEY_i,          incnmaster,     {.i = +1} },
@@ -12,4 +12,4 @@ XWAYLAND =
 XLIBS =
 # Uncomment to build XWayland support
 #XWAYLAND = -DXWAYLAND
-#XLIBS = xcb xcb-icccm
+#XLIBS = xcb xcb-icccm xcb-res
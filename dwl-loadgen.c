@@ -0,0 +1,664 @@
+/*
+ * See LICENSE file for copyright and license details.
+ *
+ * dwl-loadgen - synthetic Wayland clients for benchmarking dwl
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#include "util.h"
+#include "xdg-shell-client-protocol.h"
+#include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "idle-inhibit-unstable-v1-client-protocol.h"
+
+/* macros */
+#define MIN(A, B)               ((A) < (B) ? (A) : (B))
+#define LENGTH(X)               (sizeof X / sizeof X[0])
+
+typedef struct {
+	struct wl_buffer *wl_buffer;
+	uint32_t *data;
+	int width, height;
+	int busy; /* until released by the compositor */
+} Buffer;
+
+typedef struct {
+	struct wl_surface *surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *toplevel;
+	struct xdg_popup *popup;
+	struct zwlr_layer_surface_v1 *layer_surface;
+	struct zwp_idle_inhibitor_v1 *inhibitor;
+	Buffer buffers[2];
+	int width, height; /* of the last acked configure, 0 if ours to choose */
+	int pending_width, pending_height;
+	uint32_t serial; /* of the last configure not acked yet */
+	uint64_t ack_due; /* 0 if nothing to ack, see ackconfigure() */
+	int configured; /* acked the first configure */
+	unsigned int n; /* commits, used as the color */
+} Surface;
+
+/* function declarations */
+static void ackconfigure(Surface *s);
+static void churn(Surface *surfaces, int nsurfaces);
+static void closelayersurface(void *data, struct zwlr_layer_surface_v1 *layer_surface);
+static void closetoplevel(void *data, struct xdg_toplevel *toplevel);
+static unsigned long compositorrss(void);
+static void configurelayersurface(void *data, struct zwlr_layer_surface_v1 *layer_surface,
+		uint32_t serial, uint32_t w, uint32_t h);
+static void configurepopup(void *data, struct xdg_popup *popup,
+		int32_t x, int32_t y, int32_t w, int32_t h);
+static void configuretoplevel(void *data, struct xdg_toplevel *toplevel,
+		int32_t w, int32_t h, struct wl_array *states);
+static void configurexdgsurface(void *data, struct xdg_surface *xdg_surface, uint32_t serial);
+static void createbuffer(Buffer *b, int w, int h);
+static void createlayersurface(Surface *s);
+static void createpopup(Surface *parent, Surface *s, int i);
+static void createsurfaces(Surface *surfaces);
+static void createtoplevel(Surface *s, int i);
+static void destroysurface(Surface *s);
+static void draw(Surface *s);
+static void handlesig(int signo);
+static uint64_t monotime(void);
+static void pingwmbase(void *data, struct xdg_wm_base *base, uint32_t serial);
+static void popupdone(void *data, struct xdg_popup *popup);
+static void registryglobal(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version);
+static void registryglobalremove(void *data, struct wl_registry *registry, uint32_t name);
+static void releasebuffer(void *data, struct wl_buffer *wl_buffer);
+static void shuffle(Surface **order, int n);
+static void usage(void);
+static void waitconfigured(Surface *surfaces, int nsurfaces);
+
+/* variables */
+static struct wl_display *display;
+static struct wl_compositor *compositor;
+static struct wl_shm *shm;
+static struct xdg_wm_base *wm_base;
+static struct zwlr_layer_shell_v1 *layer_shell;
+static struct zwp_idle_inhibit_manager_v1 *idle_inhibit_mgr;
+static volatile sig_atomic_t running = 1;
+static pid_t compositor_pid; /* 0 if unknown */
+
+/* options, see usage() */
+static int ntoplevels = 1, nlayers, npopups, inhibit;
+static int width, height; /* 0 to follow configures */
+static int ack_delay; /* in ms, -1 to never ack */
+static double commit_rate = 60, title_rate;
+static double duration; /* in seconds, 0 to run until killed */
+static int churn_iterations, hotplug; /* see churn() */
+
+/* statistics */
+static unsigned long ncommits, ndropped, nconfigures, nacked, ntitles;
+
+static const struct wl_buffer_listener buffer_listener = {.release = releasebuffer};
+static const struct wl_registry_listener registry_listener = {
+	.global = registryglobal, .global_remove = registryglobalremove};
+static const struct xdg_wm_base_listener wm_base_listener = {.ping = pingwmbase};
+static const struct xdg_surface_listener xdg_surface_listener = {
+	.configure = configurexdgsurface};
+static const struct xdg_toplevel_listener toplevel_listener = {
+	.configure = configuretoplevel, .close = closetoplevel};
+static const struct xdg_popup_listener popup_listener = {
+	.configure = configurepopup, .popup_done = popupdone};
+static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
+	.configure = configurelayersurface, .closed = closelayersurface};
+
+void
+ackconfigure(Surface *s)
+{
+	if (s->layer_surface)
+		zwlr_layer_surface_v1_ack_configure(s->layer_surface, s->serial);
+	else
+		xdg_surface_ack_configure(s->xdg_surface, s->serial);
+	s->ack_due = 0;
+	s->width = s->pending_width;
+	s->height = s->pending_height;
+	nacked++;
+
+	/* Without a commit rate, draw once per configure */
+	if (!s->configured || !commit_rate)
+		draw(s);
+	s->configured = 1;
+}
+
+void
+churn(Surface *surfaces, int nsurfaces)
+{
+	/* Each iteration maps every surface, destroys the popups, last opened
+	 * first as xdg-shell wants, unmaps and remaps the toplevels, plugs an
+	 * output in or out with -o, then destroys the rest in random order.
+	 * What the compositor leaks shows up as its memory growing from one
+	 * iteration to the next. */
+	Surface **order = ecalloc(nsurfaces ? nsurfaces : 1, sizeof(*order));
+	unsigned long rss = 0, first = 0;
+	uint64_t start;
+	int it, i, n;
+
+	srand(1);
+	for (it = 0; it < churn_iterations && running; it++) {
+		start = monotime();
+		createsurfaces(surfaces);
+		waitconfigured(surfaces, nsurfaces);
+
+		for (i = nsurfaces - 1; i >= 0; i--)
+			if (surfaces[i].popup)
+				destroysurface(&surfaces[i]);
+
+		/* Unmap with a null buffer, then commit again to get a new
+		 * first configure and map again */
+		for (i = 0; i < nsurfaces; i++) {
+			if (!surfaces[i].toplevel)
+				continue;
+			wl_surface_attach(surfaces[i].surface, NULL, 0, 0);
+			wl_surface_commit(surfaces[i].surface);
+			surfaces[i].configured = 0;
+			surfaces[i].ack_due = 0;
+			wl_surface_commit(surfaces[i].surface);
+		}
+		waitconfigured(surfaces, nsurfaces);
+
+		/* Layer surfaces on an unplugged output get closed, see
+		 * closelayersurface() */
+		if (hotplug) {
+			kill(compositor_pid, it % 2 ? SIGRTMIN + 1 : SIGRTMIN);
+			wl_display_roundtrip(display);
+		}
+
+		for (i = n = 0; i < nsurfaces; i++)
+			if (surfaces[i].surface)
+				order[n++] = &surfaces[i];
+		shuffle(order, n);
+		for (i = 0; i < n; i++)
+			destroysurface(order[i]);
+		wl_display_roundtrip(display);
+
+		rss = compositorrss();
+		if (!it)
+			first = rss;
+		fprintf(stderr, "churn %d ms %.1f rss_kb %lu\n", it,
+				(monotime() - start) / 1e6, rss);
+	}
+	if (it > 1)
+		fprintf(stderr, "churn iterations %d rss_kb_first %lu rss_kb_last %lu"
+				" growth_kb_per_iteration %.1f\n", it, first, rss,
+				((double)rss - first) / (it - 1));
+	free(order);
+}
+
+void
+closelayersurface(void *data, struct zwlr_layer_surface_v1 *layer_surface)
+{
+	/* Churning outputs closes layer surfaces, see churn() */
+	if (!churn_iterations)
+		running = 0;
+	destroysurface(data);
+}
+
+void
+closetoplevel(void *data, struct xdg_toplevel *toplevel)
+{
+	running = 0;
+}
+
+unsigned long
+compositorrss(void)
+{
+	/* Resident memory of the compositor in kB, or 0 if unknown */
+	char path[64];
+	unsigned long rss;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/statm", (int)compositor_pid);
+	if (!compositor_pid || !(f = fopen(path, "r")))
+		return 0;
+	if (fscanf(f, "%*s %lu", &rss) != 1)
+		rss = 0;
+	fclose(f);
+	return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void
+configurelayersurface(void *data, struct zwlr_layer_surface_v1 *layer_surface,
+		uint32_t serial, uint32_t w, uint32_t h)
+{
+	Surface *s = data;
+	s->pending_width = w;
+	s->pending_height = h;
+	s->serial = serial;
+	nconfigures++;
+	ackconfigure(s);
+}
+
+void
+configurepopup(void *data, struct xdg_popup *popup,
+		int32_t x, int32_t y, int32_t w, int32_t h)
+{
+	Surface *s = data;
+	s->pending_width = w;
+	s->pending_height = h;
+}
+
+void
+configuretoplevel(void *data, struct xdg_toplevel *toplevel,
+		int32_t w, int32_t h, struct wl_array *states)
+{
+	Surface *s = data;
+	s->pending_width = w;
+	s->pending_height = h;
+}
+
+void
+configurexdgsurface(void *data, struct xdg_surface *xdg_surface, uint32_t serial)
+{
+	/* The first configure is always acked, or the surface never maps.
+	 * Later ones on toplevels wait for ack_delay, keeping dwl's resize
+	 * pending in the meantime. */
+	Surface *s = data;
+	s->serial = serial;
+	nconfigures++;
+	if (!s->configured || !s->toplevel || !ack_delay)
+		ackconfigure(s);
+	else if (ack_delay > 0 && !s->ack_due)
+		s->ack_due = monotime() + ack_delay * 1000000ull;
+}
+
+void
+createbuffer(Buffer *b, int w, int h)
+{
+	struct wl_shm_pool *pool;
+	int fd, stride = w * 4;
+
+	if (b->wl_buffer) {
+		wl_buffer_destroy(b->wl_buffer);
+		munmap(b->data, b->width * 4 * b->height);
+	}
+	if ((fd = memfd_create("dwl-loadgen", MFD_CLOEXEC)) < 0)
+		die("memfd_create:");
+	if (ftruncate(fd, stride * h) < 0)
+		die("ftruncate:");
+	if ((b->data = mmap(NULL, stride * h, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0)) == MAP_FAILED)
+		die("mmap:");
+	pool = wl_shm_create_pool(shm, fd, stride * h);
+	b->wl_buffer = wl_shm_pool_create_buffer(pool, 0, w, h, stride,
+			WL_SHM_FORMAT_XRGB8888);
+	wl_buffer_add_listener(b->wl_buffer, &buffer_listener, b);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+	b->width = w;
+	b->height = h;
+}
+
+void
+createlayersurface(Surface *s)
+{
+	s->surface = wl_compositor_create_surface(compositor);
+	s->layer_surface = zwlr_layer_shell_v1_get_layer_surface(layer_shell,
+			s->surface, NULL, ZWLR_LAYER_SHELL_V1_LAYER_TOP, "dwl-loadgen");
+	zwlr_layer_surface_v1_add_listener(s->layer_surface,
+			&layer_surface_listener, s);
+	zwlr_layer_surface_v1_set_anchor(s->layer_surface,
+			ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP
+			| ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT
+			| ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
+	zwlr_layer_surface_v1_set_size(s->layer_surface, 0, 20);
+	zwlr_layer_surface_v1_set_exclusive_zone(s->layer_surface, 20);
+	wl_surface_commit(s->surface);
+}
+
+void
+createpopup(Surface *parent, Surface *s, int i)
+{
+	struct xdg_positioner *positioner = xdg_wm_base_create_positioner(wm_base);
+	xdg_positioner_set_size(positioner, 100, 100);
+	xdg_positioner_set_anchor_rect(positioner, 10 * i, 10 * i, 1, 1);
+
+	s->surface = wl_compositor_create_surface(compositor);
+	s->xdg_surface = xdg_wm_base_get_xdg_surface(wm_base, s->surface);
+	xdg_surface_add_listener(s->xdg_surface, &xdg_surface_listener, s);
+	s->popup = xdg_surface_get_popup(s->xdg_surface, parent->xdg_surface, positioner);
+	xdg_popup_add_listener(s->popup, &popup_listener, s);
+	xdg_positioner_destroy(positioner);
+	wl_surface_commit(s->surface);
+}
+
+void
+createsurfaces(Surface *surfaces)
+{
+	/* Toplevels first, each followed by its popups, then layer surfaces */
+	int i, j;
+
+	for (i = 0; i < ntoplevels; i++)
+		createtoplevel(&surfaces[i * (1 + npopups)], i);
+	for (i = 0; i < nlayers; i++)
+		createlayersurface(&surfaces[ntoplevels * (1 + npopups) + i]);
+	/* Popups need a mapped parent */
+	wl_display_roundtrip(display);
+	for (i = 0; i < ntoplevels; i++)
+		for (j = 1; j <= npopups; j++)
+			createpopup(&surfaces[i * (1 + npopups)],
+					&surfaces[i * (1 + npopups) + j], j);
+}
+
+void
+createtoplevel(Surface *s, int i)
+{
+	char title[64];
+
+	s->surface = wl_compositor_create_surface(compositor);
+	s->xdg_surface = xdg_wm_base_get_xdg_surface(wm_base, s->surface);
+	xdg_surface_add_listener(s->xdg_surface, &xdg_surface_listener, s);
+	s->toplevel = xdg_surface_get_toplevel(s->xdg_surface);
+	xdg_toplevel_add_listener(s->toplevel, &toplevel_listener, s);
+	xdg_toplevel_set_app_id(s->toplevel, "dwl-loadgen");
+	snprintf(title, sizeof(title), "dwl-loadgen %d", i);
+	xdg_toplevel_set_title(s->toplevel, title);
+	if (inhibit)
+		s->inhibitor = zwp_idle_inhibit_manager_v1_create_inhibitor(
+				idle_inhibit_mgr, s->surface);
+	wl_surface_commit(s->surface);
+}
+
+void
+destroysurface(Surface *s)
+{
+	/* Role objects go before the surface, popups before their parent,
+	 * see churn(). The slot can be used again afterwards. */
+	Buffer *b;
+
+	if (s->inhibitor)
+		zwp_idle_inhibitor_v1_destroy(s->inhibitor);
+	if (s->popup)
+		xdg_popup_destroy(s->popup);
+	if (s->toplevel)
+		xdg_toplevel_destroy(s->toplevel);
+	if (s->layer_surface)
+		zwlr_layer_surface_v1_destroy(s->layer_surface);
+	if (s->xdg_surface)
+		xdg_surface_destroy(s->xdg_surface);
+	if (s->surface)
+		wl_surface_destroy(s->surface);
+	for (b = s->buffers; b < s->buffers + LENGTH(s->buffers); b++) {
+		if (!b->wl_buffer)
+			continue;
+		wl_buffer_destroy(b->wl_buffer);
+		munmap(b->data, b->width * 4 * b->height);
+	}
+	memset(s, 0, sizeof(*s));
+}
+
+void
+draw(Surface *s)
+{
+	/* Toplevels use the size given with -s, if any, even if it does not
+	 * match what dwl asked for */
+	int w = s->toplevel && width ? width : s->width ? s->width : 640;
+	int h = s->toplevel && height ? height : s->height ? s->height : 480;
+	uint32_t color = 0x010101u * (s->n++ & 0xff);
+	Buffer *b;
+	size_t i;
+
+	if (!s->buffers[0].busy)
+		b = &s->buffers[0];
+	else if (!s->buffers[1].busy)
+		b = &s->buffers[1];
+	else {
+		ndropped++;
+		return;
+	}
+	if (b->width != w || b->height != h)
+		createbuffer(b, w, h);
+	for (i = 0; i < (size_t)w * h; i++)
+		b->data[i] = color;
+
+	wl_surface_attach(s->surface, b->wl_buffer, 0, 0);
+	wl_surface_damage(s->surface, 0, 0, w, h);
+	wl_surface_commit(s->surface);
+	b->busy = 1;
+	ncommits++;
+}
+
+void
+handlesig(int signo)
+{
+	running = 0;
+}
+
+uint64_t
+monotime(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void
+pingwmbase(void *data, struct xdg_wm_base *base, uint32_t serial)
+{
+	xdg_wm_base_pong(base, serial);
+}
+
+void
+popupdone(void *data, struct xdg_popup *popup)
+{
+	/* Dismissed by the compositor: the popup is gone for good, so stop
+	 * drawing it and let its slot be reused */
+	destroysurface(data);
+}
+
+void
+registryglobal(void *data, struct wl_registry *registry,
+		uint32_t name, const char *interface, uint32_t version)
+{
+	if (!strcmp(interface, wl_compositor_interface.name))
+		compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 1);
+	else if (!strcmp(interface, wl_shm_interface.name))
+		shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	else if (!strcmp(interface, xdg_wm_base_interface.name))
+		wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+	else if (!strcmp(interface, zwlr_layer_shell_v1_interface.name))
+		layer_shell = wl_registry_bind(registry, name, &zwlr_layer_shell_v1_interface, 1);
+	else if (!strcmp(interface, zwp_idle_inhibit_manager_v1_interface.name))
+		idle_inhibit_mgr = wl_registry_bind(registry, name,
+				&zwp_idle_inhibit_manager_v1_interface, 1);
+}
+
+void
+registryglobalremove(void *data, struct wl_registry *registry, uint32_t name)
+{
+}
+
+void
+releasebuffer(void *data, struct wl_buffer *wl_buffer)
+{
+	Buffer *b = data;
+	b->busy = 0;
+}
+
+void
+shuffle(Surface **order, int n)
+{
+	Surface *tmp;
+	int i, j;
+
+	for (i = n - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+}
+
+void
+usage(void)
+{
+	die("usage: dwl-loadgen [-n toplevels] [-r commits/s] [-s WxH]\n"
+		"                   [-a ack delay ms] [-t titles/s] [-p popups]\n"
+		"                   [-l layer surfaces] [-i] [-d seconds]\n"
+		"                   [-c churn iterations [-o]]");
+}
+
+void
+waitconfigured(Surface *surfaces, int nsurfaces)
+{
+	int i;
+	for (i = 0; i < nsurfaces && running; i++)
+		while (surfaces[i].surface && !surfaces[i].configured && running)
+			if (wl_display_dispatch(display) < 0)
+				die("lost the connection to the compositor");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sigaction sa = {.sa_handler = handlesig};
+	struct wl_registry *registry;
+	struct pollfd pfd;
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	Surface *surfaces;
+	uint64_t now, start, commit_due, title_due, next;
+	int c, i, nsurfaces, timeout;
+	char title[64];
+
+	while ((c = getopt(argc, argv, "n:r:s:a:t:p:l:id:c:oh")) != -1) {
+		if (c == 'n')
+			ntoplevels = atoi(optarg);
+		else if (c == 'r')
+			commit_rate = atof(optarg);
+		else if (c == 's' && sscanf(optarg, "%dx%d", &width, &height) != 2)
+			usage();
+		else if (c == 'a')
+			ack_delay = atoi(optarg);
+		else if (c == 't')
+			title_rate = atof(optarg);
+		else if (c == 'p')
+			npopups = atoi(optarg);
+		else if (c == 'l')
+			nlayers = atoi(optarg);
+		else if (c == 'i')
+			inhibit = 1;
+		else if (c == 'd')
+			duration = atof(optarg);
+		else if (c == 'c')
+			churn_iterations = atoi(optarg);
+		else if (c == 'o')
+			hotplug = 1;
+		else if (c == 'h' || c == '?')
+			usage();
+	}
+	if (optind < argc || ntoplevels < 0 || npopups < 0 || nlayers < 0
+			|| width < 0 || height < 0 || commit_rate < 0 || title_rate < 0
+			|| churn_iterations < 0 || (hotplug && !churn_iterations))
+		usage();
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (!(display = wl_display_connect(NULL)))
+		die("cannot connect to the Wayland display");
+	registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, NULL);
+	wl_display_roundtrip(display);
+	if (!compositor || !shm || !wm_base)
+		die("the compositor lacks wl_compositor, wl_shm or xdg_wm_base");
+	if (nlayers && !layer_shell)
+		die("the compositor lacks zwlr_layer_shell_v1");
+	if (inhibit && !idle_inhibit_mgr)
+		die("the compositor lacks zwp_idle_inhibit_manager_v1");
+	xdg_wm_base_add_listener(wm_base, &wm_base_listener, NULL);
+
+	/* The compositor's memory is reported by churn(), and its outputs
+	 * hotplugged with signals, see dwl(1) */
+	if (!getsockopt(wl_display_get_fd(display), SOL_SOCKET, SO_PEERCRED, &cred, &len))
+		compositor_pid = cred.pid;
+	if (hotplug && !compositor_pid)
+		die("cannot find the compositor's process to hotplug outputs");
+
+	nsurfaces = ntoplevels * (1 + npopups) + nlayers;
+	surfaces = ecalloc(nsurfaces ? nsurfaces : 1, sizeof(*surfaces));
+	if (churn_iterations) {
+		churn(surfaces, nsurfaces);
+		running = 0;
+	} else {
+		createsurfaces(surfaces);
+	}
+
+	start = commit_due = title_due = monotime();
+	pfd.fd = wl_display_get_fd(display);
+	pfd.events = POLLIN;
+	while (running) {
+		/* Commit every surface at the same rate, regardless of frame
+		 * callbacks, so the load does not depend on what dwl does */
+		now = monotime();
+		if (duration && now - start >= duration * 1e9)
+			break;
+		if (commit_rate && now >= commit_due) {
+			for (i = 0; i < nsurfaces; i++)
+				if (surfaces[i].configured)
+					draw(&surfaces[i]);
+			commit_due += 1e9 / commit_rate;
+			if (commit_due < now)
+				commit_due = now;
+		}
+		if (title_rate && now >= title_due) {
+			for (i = 0; i < nsurfaces; i++) {
+				if (!surfaces[i].toplevel)
+					continue;
+				snprintf(title, sizeof(title), "dwl-loadgen %d %lu", i, ntitles++);
+				xdg_toplevel_set_title(surfaces[i].toplevel, title);
+			}
+			title_due += 1e9 / title_rate;
+			if (title_due < now)
+				title_due = now;
+		}
+		next = now + 1000000000;
+		if (commit_rate)
+			next = MIN(next, commit_due);
+		if (title_rate)
+			next = MIN(next, title_due);
+		for (i = 0; i < nsurfaces; i++) {
+			if (surfaces[i].ack_due && surfaces[i].ack_due <= now)
+				ackconfigure(&surfaces[i]);
+			else if (surfaces[i].ack_due)
+				next = MIN(next, surfaces[i].ack_due);
+		}
+
+		while (wl_display_prepare_read(display))
+			wl_display_dispatch_pending(display);
+		wl_display_flush(display);
+		timeout = next > now ? (next - now + 999999) / 1000000 : 0;
+		if (poll(&pfd, 1, timeout) < 0) {
+			wl_display_cancel_read(display);
+			if (errno == EINTR)
+				continue;
+			die("poll:");
+		}
+		if (pfd.revents & POLLIN) {
+			if (wl_display_read_events(display) < 0)
+				die("lost the connection to the compositor");
+		} else {
+			wl_display_cancel_read(display);
+		}
+		if (wl_display_dispatch_pending(display) < 0)
+			die("lost the connection to the compositor");
+	}
+
+	fprintf(stderr, "commits %lu dropped %lu configures %lu acked %lu titles %lu\n",
+			ncommits, ndropped, nconfigures, nacked, ntitles);
+	wl_display_disconnect(display);
+	free(surfaces);
+	return EXIT_SUCCESS;
+}
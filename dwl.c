@@ -1,18 +1,37 @@
 /*
  * See LICENSE file for copyright and license details.
  */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <libinput.h>
+#include <limits.h>
+#include <link.h>
 #include <linux/input-event-codes.h>
+#include <poll.h>
 #include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/backend.h>
+#include <wlr/backend/headless.h>
 #include <wlr/backend/libinput.h>
+#include <wlr/backend/multi.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/interfaces/wlr_pointer.h>
 #include <wlr/render/allocator.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_compositor.h>
@@ -56,7 +75,9 @@
 #ifdef XWAYLAND
 #include <wlr/xwayland.h>
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/xcb_icccm.h>
+#include <xcb/res.h>
 #endif
 
 #include "util.h"
@@ -68,13 +89,25 @@
 #define VISIBLEON(C, M)         ((M) && (C)->mon == (M) && ((C)->tags & (M)->tagset[(M)->seltags]))
 #define LENGTH(X)               (sizeof X / sizeof X[0])
 #define END(A)                  ((A) + LENGTH(A))
+#define POOLTAG                 (1u << 31) /* tags of clients waiting in a pool */
+#define TVUSEC(tv)              ((tv).tv_sec * 1000000ull + (tv).tv_usec)
+#define FOCUSED(state)          ((state).focused_client ? (state).focused_client->client : NULL) /* for account() */
+#define IOPRIO_BE(level)        ((2 << 13) | (level)) /* see ioprio_set(2) */
 #define TAGMASK                 ((1u << TAGCOUNT) - 1)
+#define SCRAPE_TIMEOUT          5000 /* ms a metrics scraper gets, see metricstimeout() */
 #define LISTEN(E, L, H)         wl_signal_add((E), ((L)->notify = (H), (L)))
 #define LISTEN_STATIC(E, H)     do { static struct wl_listener _l = {.notify = (H)}; wl_signal_add((E), &_l); } while (0)
 
 /* enums */
 enum { CurNormal, CurPressed, CurMove, CurResize }; /* cursor */
 enum { XDGShell, LayerShell, X11Managed, X11Unmanaged }; /* client types */
+enum { FreezeCgroup = 1, FreezeSignal }; /* how a client is frozen */
+enum { InputKey, InputMotion, InputMotionAbsolute, InputButton, InputAxis,
+	InputLast }; /* recorded input events */
+enum { FlightMap, FlightUnmap, FlightFocus, FlightArrange, FlightOutput,
+	FlightOutputGone, FlightConfigure, FlightKey, FlightButton }; /* see flight() */
+enum { HandlerCommit, HandlerCommitLayer, HandlerRender, HandlerMotion, HandlerKey,
+	HandlerAxis, HandlerTitle, HandlerLast }; /* see account() */
 enum { LyrBg, LyrBottom, LyrTile, LyrFloat, LyrFS, LyrTop, LyrOverlay, LyrBlock, NUM_LAYERS }; /* scene layers */
 #ifdef XWAYLAND
 enum { NetWMWindowTypeDialog, NetWMWindowTypeSplash, NetWMWindowTypeToolbar,
@@ -88,6 +121,11 @@ typedef union {
 	const void *v;
 } Arg;
 
+typedef struct {
+	pid_t tid;
+	int nice, boosted; /* niceness before and after boostprocess() */
+} BoostedThread;
+
 typedef struct {
 	unsigned int mod;
 	unsigned int button;
@@ -96,6 +134,7 @@ typedef struct {
 } Button;
 
 typedef struct Monitor Monitor;
+typedef struct Pool Pool;
 typedef struct {
 	/* Must keep these three elements in this order */
 	unsigned int type; /* XDGShell or X11* */
@@ -117,6 +156,7 @@ typedef struct {
 	struct wl_listener destroy;
 	struct wl_listener set_title;
 	struct wl_listener fullscreen;
+	struct wl_listener ping_timeout;
 	struct wlr_box prev; /* layout-relative, includes border */
 	struct wlr_box bounds;
 #ifdef XWAYLAND
@@ -125,13 +165,62 @@ typedef struct {
 	struct wl_listener dissociate;
 	struct wl_listener configure;
 	struct wl_listener set_hints;
+	int configurepending; /* see configurex11() */
+	unsigned int nconfigure, ncoalesced; /* configure requests while tiled */
 #endif
 	unsigned int bw;
 	uint32_t tags;
 	int isfloating, isurgent, isfullscreen;
+	int isunresponsive, pingtimedout;
+	int isoccluded; /* hidden behind another client, see arrange() */
+	int isopaque; /* at its last commit, see commitnotify() */
+	int freeze, frozen; /* freeze rule, FreezeCgroup or FreezeSignal if frozen */
+	int noboost;
+	const Pool *pool; /* while waiting in it */
+	uint64_t hiddensince; /* see monotime() */
 	uint32_t resize; /* configure serial of a pending resize */
+	uint64_t spawntime, committime, maptime; /* see monotime() */
 } Client;
 
+typedef struct {
+	uint64_t time; /* see monotime() */
+	unsigned int type; /* FlightMap... */
+	uint32_t a, b;
+	char text[24];
+} FlightEvent;
+
+typedef struct {
+	pid_t pid; /* 0 if unused */
+	int fd; /* cgroup.freeze if frozen with the cgroup, -1 if stopped */
+} Frozen;
+
+typedef struct {
+	void *ptr;
+	int held; /* reset, like ptr, when the object is destroyed */
+	struct wl_listener destroy;
+} Held;
+
+typedef struct {
+	uint64_t count, sum; /* sum in usec */
+	uint64_t bucket[32]; /* bucket[i] counts values < 2^i usec */
+} Histogram;
+
+typedef struct {
+	struct wl_list link;
+	struct wlr_idle_inhibitor_v1 *inhibitor;
+	struct wl_listener destroy;
+	int visible; /* counted in ninhibiting */
+} Inhibitor;
+
+typedef struct {
+	uint64_t time; /* since the start of the recording, in ns */
+	uint16_t type; /* InputKey... */
+	uint16_t state; /* key or button state, axis source */
+	uint32_t code; /* keycode, button or axis orientation */
+	double x, y; /* motion delta or position, axis delta and discrete delta */
+	double ux, uy; /* unaccelerated motion delta */
+} InputEvent;
+
 typedef struct {
 	uint32_t mod;
 	xkb_keysym_t keysym;
@@ -146,6 +235,9 @@ typedef struct {
 	int nsyms;
 	const xkb_keysym_t *keysyms; /* invalid if nsyms == 0 */
 	uint32_t mods; /* invalid if nsyms == 0 */
+	uint64_t repeat_start; /* time of the first repeat, see monotime() */
+	uint64_t repeat_n; /* number of the next repeat */
+	int key_repeat_fd; /* timerfd */
 	struct wl_event_source *key_repeat_source;
 
 	struct wl_listener modifiers;
@@ -171,6 +263,22 @@ typedef struct {
 	struct wl_listener surface_commit;
 } LayerSurface;
 
+typedef struct {
+	struct wl_list link;
+	pid_t pid;
+	uint64_t time;
+	const Pool *pool; /* started to fill it */
+	struct wlr_xdg_activation_token_v1 *token;
+	struct wl_listener destroy;
+} Launch;
+
+typedef struct {
+	struct wl_list link;
+	char *appid;
+	Histogram commit; /* spawn -> first commit */
+	Histogram map; /* spawn -> map */
+} LaunchStats;
+
 typedef struct {
 	const char *symbol;
 	void (*arrange)(Monitor *);
@@ -197,6 +305,11 @@ struct Monitor {
 	int gamma_lut_changed;
 	int nmaster;
 	char ltsymbol[16];
+	uint64_t frame_due; /* on the virtual clock, see stepclock() */
+	int virtual_frame; /* asked for by stepclock(), see rendermon() */
+	int occlusionchanged; /* see occlusiontimeout() */
+	uint64_t cpu; /* spent rendering it, in ns */
+	uint64_t rendered, skipped; /* frames, see rendermon() */
 };
 
 typedef struct {
@@ -209,14 +322,52 @@ typedef struct {
 	int x, y;
 } MonitorRule;
 
+typedef struct {
+	/* Accounting of a Wayland client connection, see logrequest() */
+	struct wl_client *client;
+	struct wl_list link;
+	struct wl_listener destroy;
+	uint64_t window; /* accounting window the counters below belong to */
+	unsigned int requests, commits;
+	uint64_t total_requests, total_commits, nthrottled;
+	int throttled;
+	uint64_t frames, cpu; /* frame callbacks sent, handler CPU time in ns */
+	int buffer_width, buffer_height; /* of its last commit */
+	/* The latest requests of each kind held back while throttled, applied
+	 * by unthrottle() */
+	Held selection, primary_selection, cursor, activation;
+	uint32_t selection_serial, primary_selection_serial;
+	const char *cursor_shape; /* instead of the cursor surface */
+	int32_t hotspot_x, hotspot_y;
+} Peer;
+
+struct Pool {
+	const char *id;
+	int count;
+	const char *const *cmd;
+};
+
 typedef struct {
 	const char *id;
 	const char *title;
 	uint32_t tags;
 	int isfloating;
 	int monitor;
+	int freeze;
+	int noboost;
 } Rule;
 
+typedef struct {
+	struct wl_list link;
+	int fd;
+	struct wl_event_source *source;
+	char request[1024];
+	size_t len; /* read of the request, then written of the response */
+	char *response;
+	size_t size;
+	uint64_t since; /* see metricstimeout() */
+} Scraper;
+
 typedef struct {
 	struct wlr_scene_tree *scene;
 
@@ -226,23 +377,39 @@ typedef struct {
 	struct wl_listener destroy;
 } SessionLock;
 
+typedef struct {
+	struct wl_list link;
+	struct wl_event_source *source;
+	int (*func)(void *data);
+	void *data;
+	uint64_t due; /* on the virtual clock, 0 if disarmed */
+} Timer;
+
 /* function declarations */
+static uint64_t account(unsigned int handler, uint64_t start, struct wl_client *client);
+static void addtimer(Timer *t, int (*func)(void *data), void *data);
 static void applybounds(Client *c, struct wlr_box *bbox);
+static void applyheld(Peer *p);
+static void armkeyrepeat(Keyboard *kb);
 static void applyrules(Client *c);
 static void arrange(Monitor *m);
 static void arrangelayer(Monitor *m, struct wl_list *list,
 		struct wlr_box *usable_area, int exclusive);
 static void arrangelayers(Monitor *m);
 static void axisnotify(struct wl_listener *listener, void *data);
+static void boostclient(Client *c);
+static void boostprocess(pid_t pid, int boost);
 static void buttonpress(struct wl_listener *listener, void *data);
+static int canocclude(Client *c);
 static void chvt(const Arg *arg);
-static void checkidleinhibitor(struct wlr_surface *exclude);
 static void cleanup(void);
 static void cleanupkeyboard(struct wl_listener *listener, void *data);
 static void cleanupmon(struct wl_listener *listener, void *data);
 static void closemon(Monitor *m);
+static void closescraper(Scraper *s);
 static void commitlayersurfacenotify(struct wl_listener *listener, void *data);
 static void commitnotify(struct wl_listener *listener, void *data);
+static uint64_t cputime(void);
 static void createdecoration(struct wl_listener *listener, void *data);
 static void createidleinhibitor(struct wl_listener *listener, void *data);
 static void createkeyboard(struct wlr_keyboard *keyboard);
@@ -250,51 +417,106 @@ static void createlayersurface(struct wl_listener *listener, void *data);
 static void createlocksurface(struct wl_listener *listener, void *data);
 static void createmon(struct wl_listener *listener, void *data);
 static void createnotify(struct wl_listener *listener, void *data);
+static void createpeer(struct wl_listener *listener, void *data);
 static void createpointer(struct wlr_pointer *pointer);
+static void crash(int signo);
 static void cursorframe(struct wl_listener *listener, void *data);
 static void destroydragicon(struct wl_listener *listener, void *data);
 static void destroyidleinhibitor(struct wl_listener *listener, void *data);
+static void destroylaunch(struct wl_listener *listener, void *data);
 static void destroylayersurfacenotify(struct wl_listener *listener, void *data);
 static void destroylock(SessionLock *lock, int unlocked);
 static void destroylocksurface(struct wl_listener *listener, void *data);
 static void destroynotify(struct wl_listener *listener, void *data);
+static void destroypeer(struct wl_listener *listener, void *data);
 static void destroysessionlock(struct wl_listener *listener, void *data);
 static void destroysessionmgr(struct wl_listener *listener, void *data);
 static Monitor *dirtomon(enum wlr_direction dir);
+static int dispatchinput(int fd, uint32_t mask, void *data);
+static void dumpflight(int signo);
+static int dumpstats(int signo, void *data);
+static void findheadlessbackend(struct wlr_backend *b, void *data);
+static void findinputbackend(struct wlr_backend *b, void *data);
+static int findxkbcommon(struct dl_phdr_info *info, size_t size, void *data);
+static void flight(unsigned int type, uint32_t a, uint32_t b, const char *text);
+static void flightatexit(void);
+static char *fmtnum(char *p, uint64_t n);
+static char *fmtstr(char *p, const char *s);
 static void focusclient(Client *c, int lift);
 static void focusmon(const Arg *arg);
 static void focusstack(const Arg *arg);
 static Client *focustop(Monitor *m);
+static void freezeclient(Client *c);
+static int freezeclients(void *data);
+static int freezeprocess(pid_t pid, const char *cgroup);
 static void fullscreennotify(struct wl_listener *listener, void *data);
+static int getcgroup(pid_t pid, char *buf, size_t len);
+static Peer *getpeer(struct wl_client *client);
 static void handlesig(int signo);
+static uint32_t hashbytes(uint32_t hash, const void *data, size_t len);
+static void histadd(Histogram *h, uint64_t usec);
+static void hold(Held *h, void *ptr, struct wl_signal *destroy);
+static void holddestroy(struct wl_listener *listener, void *data);
+static int hotplug(int signo, void *data);
 static void incnmaster(const Arg *arg);
 static void inputdevice(struct wl_listener *listener, void *data);
+static int isowncgroup(const char *cgroup, pid_t pid);
+static int isthrottled(struct wl_client *client);
 static int keybinding(uint32_t mods, xkb_keysym_t sym);
 static void keypress(struct wl_listener *listener, void *data);
 static void keypressmod(struct wl_listener *listener, void *data);
-static int keyrepeat(void *data);
+static int keyrepeat(int fd, uint32_t mask, void *data);
 static void killclient(const Arg *arg);
+static pid_t launch(char *const argv[], char *const envp[], int infd,
+		int outfd, int newsession);
+static Launch *launchfind(pid_t pid);
+static void launchrecord(Client *c, uint64_t spawntime);
+static void listenmetrics(const char *display);
+static struct xkb_keymap *loadkeymap(void);
 static void locksession(struct wl_listener *listener, void *data);
+static void logrequest(void *data, enum wl_protocol_logger_type type,
+		const struct wl_protocol_logger_message *message);
 static void maplayersurfacenotify(struct wl_listener *listener, void *data);
 static void mapnotify(struct wl_listener *listener, void *data);
 static void maximizenotify(struct wl_listener *listener, void *data);
+static int metricsaccept(int fd, uint32_t mask, void *data);
+static int metricsserve(int fd, uint32_t mask, void *data);
+static int metricstimeout(void *data);
 static void monocle(Monitor *m);
+static uint64_t monotime(void);
 static void motionabsolute(struct wl_listener *listener, void *data);
 static void motionnotify(uint32_t time);
 static void motionrelative(struct wl_listener *listener, void *data);
 static void moveresize(const Arg *arg);
+static void noteinput(unsigned int type, uint32_t code, uint32_t state,
+		double x, double y, double ux, double uy);
+static int occlusiontimeout(void *data);
 static void outputmgrapply(struct wl_listener *listener, void *data);
 static void outputmgrapplyortest(struct wlr_output_configuration_v1 *config, int test);
 static void outputmgrtest(struct wl_listener *listener, void *data);
+static void pausemetrics(int pause);
+static int pingclients(void *data);
+static void pingtimeout(struct wl_listener *listener, void *data);
 static void pointerfocus(Client *c, struct wlr_surface *surface,
 		double sx, double sy, uint32_t time);
+static void poolfill(void);
+static void printhist(const char *name, Histogram *h);
+static void printmetrichist(FILE *f, const char *name, const char *labels, Histogram *h);
+static void printmetrics(FILE *f);
 static void printstatus(void);
+static unsigned long long procstart(pid_t pid);
 static void quit(const Arg *arg);
+static int readclock(int fd, uint32_t mask, void *data);
 static void rendermon(struct wl_listener *listener, void *data);
+static int replayinput(void *data);
 static void requeststartdrag(struct wl_listener *listener, void *data);
 static void requestmonstate(struct wl_listener *listener, void *data);
+static int resetstats(int signo, void *data);
 static void resize(Client *c, struct wlr_box geo, int interact);
 static void run(char *startup_cmd);
+static void sendframedone(struct wlr_scene_buffer *buffer, int sx, int sy, void *data);
+static struct wl_client *serialclient(uint32_t serial);
+static void setcloexec(void);
 static void setcursor(struct wl_listener *listener, void *data);
 static void setcursorshape(struct wl_listener *listener, void *data);
 static void setfloating(Client *c, int floating);
@@ -305,22 +527,39 @@ static void setmfact(const Arg *arg);
 static void setmon(Client *c, Monitor *m, uint32_t newtags);
 static void setpsel(struct wl_listener *listener, void *data);
 static void setsel(struct wl_listener *listener, void *data);
+static void settimer(Timer *t, int ms);
+static int settleclock(void);
 static void setup(void);
+static void seturgent(struct wlr_surface *surface,
+		struct wlr_xdg_activation_token_v1 *token);
+static int sharesprocess(Client *c, pid_t pid, const char *cgroup);
 static void spawn(const Arg *arg);
+static Launch *spawncmd(const char *const *cmd, const Pool *pool);
 static void startdrag(struct wl_listener *listener, void *data);
+static void stepclock(void);
+static void suspendscene(int suspend);
 static void tag(const Arg *arg);
 static void tagmon(const Arg *arg);
+static void thawall(void);
+static void thawclient(Client *c);
+static void thawprocess(pid_t pid);
 static void tile(Monitor *m);
+static void tilegeom(struct wlr_box area, double mfact, int nmaster,
+		unsigned int n, struct wlr_box *geom);
 static void togglefloating(const Arg *arg);
 static void togglefullscreen(const Arg *arg);
 static void toggletag(const Arg *arg);
 static void toggleview(const Arg *arg);
 static void unlocksession(struct wl_listener *listener, void *data);
 static void unmaplayersurfacenotify(struct wl_listener *listener, void *data);
+static void unhold(Held *h);
 static void unmapnotify(struct wl_listener *listener, void *data);
+static int unthrottle(void *data);
+static void updateidleinhibitors(struct wlr_surface *root, int unmapping);
 static void updatemons(struct wl_listener *listener, void *data);
 static void updatetitle(struct wl_listener *listener, void *data);
 static void urgent(struct wl_listener *listener, void *data);
+static void usepool(const Arg *arg);
 static void view(const Arg *arg);
 static void virtualkeyboard(struct wl_listener *listener, void *data);
 static Monitor *xytomon(double x, double y);
@@ -331,10 +570,13 @@ static void zoom(const Arg *arg);
 /* variables */
 static const char broken[] = "broken";
 static pid_t child_pid = -1;
+static volatile sig_atomic_t running = 1;
 static int locked;
 static void *exclusive_focus;
 static struct wl_display *dpy;
+static struct wl_display *input_dpy; /* only runs the libinput event loop */
 static struct wlr_backend *backend;
+static struct wlr_backend *headless_backend; /* see hotplug() */
 static struct wlr_scene *scene;
 static struct wlr_scene_tree *layers[NUM_LAYERS];
 static struct wlr_scene_tree *drag_icon;
@@ -348,10 +590,34 @@ static struct wlr_session *session;
 static struct wlr_xdg_shell *xdg_shell;
 static struct wlr_xdg_activation_v1 *activation;
 static struct wlr_xdg_decoration_manager_v1 *xdg_decoration_mgr;
+static struct wl_list launches; /* spawned commands without a window yet */
+static struct wl_list launchstats;
+static struct wl_list peers;
+static Timer throttle_timer;
+static struct wl_listener peer_created = {.notify = createpeer};
+static Timer ping_timer;
+static Timer freeze_timer;
+static Frozen frozen[64]; /* see freezeprocess() and thawall() */
+static uint64_t freeze_deadline; /* of freeze_timer, 0 if disarmed */
+static Timer occlusion_timer;
+static int occlusion_armed; /* see commitnotify() */
+static pid_t boost_pid; /* process of the focused client, see boostclient() */
+static BoostedThread *boost_threads; /* reniced by boostprocess() */
+static size_t boost_nthreads, boost_size;
+static struct wlr_box *tile_geom; /* see tile() */
+static unsigned int tile_size;
+static unsigned long long boost_start; /* of boost_pid, see procstart() */
+static int nice_denied;
+static unsigned int pool_hits, pool_misses;
+static unsigned int tokens_expired; /* launches whose token timed out, see destroylaunch() */
+static int status_deferred;
+static uint64_t status_held, status_errors; /* see printmetrics() */
 static struct wl_list clients; /* tiling order */
 static struct wl_list fstack;  /* focus order */
 static struct wlr_idle_notifier_v1 *idle_notifier;
 static struct wlr_idle_inhibit_manager_v1 *idle_inhibit_mgr;
+static struct wl_list inhibitors;
+static int ninhibiting; /* inhibitors on visible surfaces */
 static struct wlr_layer_shell_v1 *layer_shell;
 static struct wlr_output_manager_v1 *output_mgr;
 static struct wlr_gamma_control_manager_v1 *gamma_control_mgr;
@@ -368,6 +634,45 @@ static struct wl_listener lock_listener = {.notify = locksession};
 
 static struct wlr_seat *seat;
 static struct wl_list keyboards;
+static struct xkb_keymap *shared_keymap; /* used by all keyboards, see loadkeymap() */
+static Histogram repeat_lateness;
+static Histogram arrange_time, arrangelayers_time, frame_time; /* see dumpstats() */
+static Histogram map_time, unmap_time, destroy_time;
+static struct rusage stats_rusage; /* at the last resetstats() */
+static const char *handler_names[] = {"commitnotify", "commitlayersurfacenotify",
+	"rendermon", "motionnotify", "keypress", "axisnotify", "updatetitle"};
+static uint64_t handler_calls[HandlerLast], handler_cpu[HandlerLast]; /* cpu in ns */
+static uint64_t virtual_now, clock_target; /* ns, non-zero with a virtual clock */
+static int clock_fd = -1, clock_eof; /* see readclock() */
+static struct wl_event_source *clock_source;
+static struct wl_list timers; /* see addtimer() */
+static Histogram input_latency[InputLast], input_cpu[InputLast];
+static uint64_t input_pending[InputLast]; /* oldest event not followed by a frame */
+static uint64_t input_events[InputLast];
+static const char *input_names[] = {"key", "motion", "motionabsolute", "button", "axis"};
+static FILE *record_file, *replay_file; /* see noteinput() and replayinput() */
+static uint64_t record_start, replay_start;
+static int replay_fast;
+static InputEvent replay_next;
+static Timer replay_timer;
+static struct wlr_keyboard replay_keyboard;
+static struct wlr_pointer replay_pointer;
+static const struct wlr_keyboard_impl replay_keyboard_impl = {.name = "dwl-replay"};
+static const struct wlr_pointer_impl replay_pointer_impl = {.name = "dwl-replay"};
+static uint64_t repeat_skipped;
+static FlightEvent flight_ring[256]; /* see flight() */
+static volatile unsigned long flight_n; /* events ever recorded */
+static uint32_t flight_pointer; /* pointer events since the last recorded input */
+static const char *flight_names[] = {"map", "unmap", "focus", "arrange", "output",
+	"outputgone", "configure", "key", "button"};
+static char flight_path[PATH_MAX]; /* see dumpflight() */
+static char crash_stack[65536]; /* lets crash() run on a stack overflow */
+static int metrics_fd = -1; /* see listenmetrics() */
+static char metrics_path[PATH_MAX];
+static struct wl_event_source *metrics_source;
+static int metrics_paused; /* see pausemetrics() */
+static struct wl_list scrapers;
+static Timer metrics_timer;
 static unsigned int cursor_mode;
 static Client *grabc;
 static int grabcx, grabcy; /* client-relative */
@@ -378,15 +683,29 @@ static struct wl_list mons;
 static Monitor *selmon;
 
 #ifdef XWAYLAND
+static void ackconfigurex11(Client *c);
 static void activatex11(struct wl_listener *listener, void *data);
 static void associatex11(struct wl_listener *listener, void *data);
 static void configurex11(struct wl_listener *listener, void *data);
 static void createnotifyx11(struct wl_listener *listener, void *data);
 static void dissociatex11(struct wl_listener *listener, void *data);
-static xcb_atom_t getatom(xcb_connection_t *xc, const char *name);
 static void sethints(struct wl_listener *listener, void *data);
+static void xwaylanddisconnect(void);
+static int xwaylandidle(void *data);
 static void xwaylandready(struct wl_listener *listener, void *data);
+static int xwaylandreply(int fd, uint32_t mask, void *data);
+static int xwaylandstopped(void *data);
 static struct wlr_xwayland *xwayland;
+static Timer xwayland_timer, xwayland_stop_timer;
+static unsigned int nxclients; /* X11 surfaces, see xwaylandidle() */
+static int xwayland_idle; /* ms, xwayland_timeout made safe in setup() */
+static xcb_connection_t *xwayland_xc; /* opened by xwaylandready() */
+static xcb_atom_t wm_s0; /* owned by the window manager of wlroots */
+static struct wl_event_source *xwayland_query; /* see xwaylandreply() */
+static xcb_get_selection_owner_cookie_t wm_cookie;
+static xcb_res_query_clients_cookie_t clients_cookie;
+static pid_t xwayland_stopping; /* sent SIGTERM, see xwaylandstopped() */
+static unsigned int xwayland_stops, xwayland_kills;
 static xcb_atom_t netatom[NetLast];
 #endif
 
@@ -397,6 +716,29 @@ static xcb_atom_t netatom[NetLast];
 #include "client.h"
 
 /* function implementations */
+uint64_t
+account(unsigned int handler, uint64_t start, struct wl_client *client)
+{
+	/* Charge the CPU time since start to handler, and to the client it
+	 * was working for if any, see dumpstats() */
+	uint64_t cpu = cputime() - start;
+	Peer *p;
+	handler_calls[handler]++;
+	handler_cpu[handler] += cpu;
+	if ((p = getpeer(client)))
+		p->cpu += cpu;
+	return cpu;
+}
+
+void
+addtimer(Timer *t, int (*func)(void *data), void *data)
+{
+	t->source = wl_event_loop_add_timer(wl_display_get_event_loop(dpy), func, data);
+	t->func = func;
+	t->data = data;
+	wl_list_insert(&timers, &t->link);
+}
+
 void
 applybounds(Client *c, struct wlr_box *bbox)
 {
@@ -414,6 +756,34 @@ applybounds(Client *c, struct wlr_box *bbox)
 		c->geom.y = bbox->y;
 }
 
+void
+applyheld(Peer *p)
+{
+	/* Requests held back while the client was throttled */
+	struct wlr_seat_client *focused = seat->pointer_state.focused_client;
+
+	if (p->selection.held)
+		wlr_seat_set_selection(seat, p->selection.ptr, p->selection_serial);
+	if (p->primary_selection.held)
+		wlr_seat_set_primary_selection(seat, p->primary_selection.ptr,
+				p->primary_selection_serial);
+	/* Like setcursor(), only for the client with pointer focus */
+	if (p->cursor.held && focused && focused->client == p->client
+			&& (cursor_mode == CurNormal || cursor_mode == CurPressed)) {
+		if (p->cursor_shape)
+			wlr_cursor_set_xcursor(cursor, cursor_mgr, p->cursor_shape);
+		else
+			wlr_cursor_set_surface(cursor, p->cursor.ptr, p->hotspot_x, p->hotspot_y);
+	}
+	/* The token is not kept, it expires */
+	if (p->activation.held)
+		seturgent(p->activation.ptr, NULL);
+	unhold(&p->selection);
+	unhold(&p->primary_selection);
+	unhold(&p->cursor);
+	unhold(&p->activation);
+}
+
 void
 applyrules(Client *c)
 {
@@ -433,6 +803,8 @@ applyrules(Client *c)
 		if ((!r->title || strstr(title, r->title))
 				&& (!r->id || strstr(appid, r->id))) {
 			c->isfloating = r->isfloating;
+			c->freeze = r->freeze;
+			c->noboost = r->noboost;
 			newtags |= r->tags;
 			i = 0;
 			wl_list_for_each(m, &mons, link)
@@ -441,17 +813,68 @@ applyrules(Client *c)
 		}
 	}
 	wlr_scene_node_reparent(&c->scene->node, layers[c->isfloating ? LyrFloat : LyrTile]);
-	setmon(c, mon, newtags);
+	setmon(c, mon, c->pool ? POOLTAG : newtags);
+}
+
+void
+armkeyrepeat(Keyboard *kb)
+{
+	/* Repeats are scheduled on absolute deadlines, repeat N happens
+	 * delay + N / rate after the key press, so they never drift */
+	struct itimerspec its = {0};
+	uint64_t t;
+
+	if (!virtual_now && kb->nsyms && kb->wlr_keyboard->repeat_info.rate > 0) {
+		t = kb->repeat_start + kb->repeat_n * 1000000000ull
+			/ kb->wlr_keyboard->repeat_info.rate;
+		its.it_value.tv_sec = t / 1000000000;
+		its.it_value.tv_nsec = t % 1000000000;
+	}
+	timerfd_settime(kb->key_repeat_fd, TFD_TIMER_ABSTIME, &its, NULL);
 }
 
 void
 arrange(Monitor *m)
 {
-	Client *c;
+	Client *c, *occluder = NULL;
+	uint64_t start = monotime();
+	int visible, nvisible = 0;
+
+	/* Clients behind an opaque fullscreen client, or tiled clients behind
+	 * the top one in monocle, can't be seen and are treated as hidden */
+	if ((c = focustop(m)) && c->isfullscreen && client_is_opaque(c)) {
+		occluder = c;
+	} else if (m->lt[m->sellt]->arrange == monocle) {
+		wl_list_for_each(c, &fstack, flink) {
+			if (VISIBLEON(c, m) && !c->isfloating && !c->isfullscreen) {
+				occluder = client_is_opaque(c) ? c : NULL;
+				break;
+			}
+		}
+	}
+
 	wl_list_for_each(c, &clients, link) {
 		if (c->mon == m) {
-			wlr_scene_node_set_enabled(&c->scene->node, VISIBLEON(c, m));
-			client_set_suspended(c, !VISIBLEON(c, m));
+			c->isoccluded = occluder && c != occluder && VISIBLEON(c, m)
+					&& (occluder->isfullscreen || !c->isfloating);
+			visible = VISIBLEON(c, m) && !c->isoccluded;
+			if (c->scene->node.enabled != visible) {
+				wlr_scene_node_set_enabled(&c->scene->node, visible);
+				updateidleinhibitors(client_surface(c), 0);
+			}
+			client_set_suspended(c, locked || !visible);
+			if (visible) {
+				nvisible++;
+				c->hiddensince = 0;
+				if (c->frozen)
+					thawclient(c);
+			} else if (c->freeze && !c->hiddensince) {
+				c->hiddensince = monotime();
+				if (!freeze_deadline) {
+					freeze_deadline = c->hiddensince + freeze_delay * 1000000ull;
+					settimer(&freeze_timer, MAX(freeze_delay, 1));
+				}
+			}
 		}
 	}
 
@@ -460,10 +883,11 @@ arrange(Monitor *m)
 
 	strncpy(m->ltsymbol, m->lt[m->sellt]->symbol, LENGTH(m->ltsymbol));
 
+	flight(FlightArrange, m->tagset[m->seltags], nvisible, m->wlr_output->name);
 	if (m->lt[m->sellt]->arrange)
 		m->lt[m->sellt]->arrange(m);
 	motionnotify(0);
-	checkidleinhibitor(NULL);
+	histadd(&arrange_time, (monotime() - start) / 1000);
 }
 
 void
@@ -497,6 +921,7 @@ arrangelayers(Monitor *m)
 		ZWLR_LAYER_SHELL_V1_LAYER_TOP,
 	};
 	LayerSurface *layersurface;
+	uint64_t start = monotime();
 	if (!m->wlr_output->enabled)
 		return;
 
@@ -512,6 +937,7 @@ arrangelayers(Monitor *m)
 	/* Arrange non-exlusive surfaces from top->bottom */
 	for (i = 3; i >= 0; i--)
 		arrangelayer(m, &m->layers[i], &usable_area, 0);
+	histadd(&arrangelayers_time, (monotime() - start) / 1000);
 
 	/* Find topmost keyboard interactive layer, if such a layer exists */
 	for (i = 0; i < LENGTH(layers_above_shell); i++) {
@@ -535,6 +961,9 @@ axisnotify(struct wl_listener *listener, void *data)
 	/* This event is forwarded by the cursor when a pointer emits an axis event,
 	 * for example when you move the scroll wheel. */
 	struct wlr_pointer_axis_event *event = data;
+	uint64_t cpu = cputime();
+	noteinput(InputAxis, event->orientation, event->source,
+			event->delta, event->delta_discrete, 0, 0);
 	wlr_idle_notifier_v1_notify_activity(idle_notifier, seat);
 	/* TODO: allow usage of scroll whell for mousebindings, it can be implemented
 	 * checking the event's orientation and the delta of the event */
@@ -542,6 +971,99 @@ axisnotify(struct wl_listener *listener, void *data)
 	wlr_seat_pointer_notify_axis(seat,
 			event->time_msec, event->orientation, event->delta,
 			event->delta_discrete, event->source);
+	account(HandlerAxis, cpu, FOCUSED(seat->pointer_state));
+}
+
+void
+boostclient(Client *c)
+{
+	/* Move the priority boost to the process of the newly focused client */
+	pid_t pid = c && !c->noboost ? client_get_pid(c) : 0;
+
+	if (pid == getpid())
+		pid = 0;
+	if (pid == boost_pid)
+		return;
+	if (boost_pid > 0)
+		boostprocess(boost_pid, 0);
+	if ((boost_pid = pid) > 0)
+		boostprocess(boost_pid, 1);
+}
+
+void
+boostprocess(pid_t pid, int boost)
+{
+	/* Niceness and I/O priority are per thread, change all of them. The
+	 * niceness of each thread is saved, and only restored if it is still
+	 * the one we set, in the same process: pids can be reused. */
+	char path[64];
+	struct dirent *ent;
+	BoostedThread *t, *main_t, *tmp;
+	DIR *dir;
+	pid_t tid;
+	int prio;
+
+	if (boost) {
+		boost_nthreads = 0;
+		boost_start = procstart(pid);
+	} else if (!boost_start || procstart(pid) != boost_start) {
+		boost_nthreads = 0;
+		return;
+	}
+	snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+	if (!(dir = opendir(path)))
+		return;
+	while ((ent = readdir(dir))) {
+		if ((tid = atoi(ent->d_name)) <= 0)
+			continue;
+
+		errno = 0;
+		prio = getpriority(PRIO_PROCESS, tid);
+		if (focus_nice && !errno && boost && !nice_denied) {
+			if (boost_nthreads == boost_size && (tmp = realloc(boost_threads,
+					(boost_size * 2 + 16) * sizeof(*tmp)))) {
+				boost_threads = tmp;
+				boost_size = boost_size * 2 + 16;
+			}
+			if (boost_nthreads == boost_size) {
+				/* Out of memory, don't change what we can't restore */
+			} else if (setpriority(PRIO_PROCESS, tid, prio + focus_nice) == 0) {
+				t = &boost_threads[boost_nthreads++];
+				t->tid = tid;
+				t->nice = prio;
+				/* Possibly clamped to -20 */
+				t->boosted = getpriority(PRIO_PROCESS, tid);
+			} else if ((errno == EACCES || errno == EPERM) && !boost_nthreads) {
+				/* Not allowed to lower niceness, only boost I/O from now on */
+				wlr_log(WLR_INFO, "cannot renice focused clients: %s", strerror(errno));
+				nice_denied = 1;
+			}
+		} else if (focus_nice && !errno && !boost) {
+			/* Threads started since inherited the niceness of the one
+			 * that started them, assume it was the main thread */
+			t = main_t = NULL;
+			for (tmp = boost_threads; tmp < boost_threads + boost_nthreads; tmp++) {
+				if (tmp->tid == tid)
+					t = tmp;
+				if (tmp->tid == pid)
+					main_t = tmp;
+			}
+			if ((t = t ? t : main_t) && prio == t->boosted)
+				setpriority(PRIO_PROCESS, tid, t->nice);
+		}
+
+		/* Only touch threads with the default I/O priority, or ours */
+		if (focus_ioprio >= 0) {
+			prio = syscall(SYS_ioprio_get, 1 /* IOPRIO_WHO_PROCESS */, tid);
+			if (boost && prio >= 0 && (prio >> 13) == 0)
+				syscall(SYS_ioprio_set, 1, tid, IOPRIO_BE(focus_ioprio));
+			else if (!boost && prio == IOPRIO_BE(focus_ioprio))
+				syscall(SYS_ioprio_set, 1, tid, 0);
+		}
+	}
+	closedir(dir);
+	if (!boost)
+		boost_nthreads = 0;
 }
 
 void
@@ -553,6 +1075,7 @@ buttonpress(struct wl_listener *listener, void *data)
 	Client *c;
 	const Button *b;
 
+	noteinput(InputButton, event->button, event->state, 0, 0, 0, 0);
 	wlr_idle_notifier_v1_notify_activity(idle_notifier, seat);
 
 	switch (event->state) {
@@ -597,34 +1120,62 @@ buttonpress(struct wl_listener *listener, void *data)
 			event->time_msec, event->button, event->state);
 }
 
-void
-chvt(const Arg *arg)
+int
+canocclude(Client *c)
 {
-	wlr_session_change_vt(session, arg->ui);
+	/* Whether c hides the clients behind it when it is opaque, see arrange() */
+	Client *t;
+	if (!c->mon || !VISIBLEON(c, c->mon))
+		return 0;
+	if (c->isfullscreen)
+		return c == focustop(c->mon);
+	if (c->isfloating || c->mon->lt[c->mon->sellt]->arrange != monocle)
+		return 0;
+	wl_list_for_each(t, &fstack, flink)
+		if (VISIBLEON(t, c->mon) && !t->isfloating && !t->isfullscreen)
+			return t == c;
+	return 0;
 }
 
 void
-checkidleinhibitor(struct wlr_surface *exclude)
+chvt(const Arg *arg)
 {
-	int inhibited = 0, unused_lx, unused_ly;
-	struct wlr_idle_inhibitor_v1 *inhibitor;
-	wl_list_for_each(inhibitor, &idle_inhibit_mgr->inhibitors, link) {
-		struct wlr_surface *surface = wlr_surface_get_root_surface(inhibitor->surface);
-		struct wlr_scene_tree *tree = surface->data;
-		if (exclude != surface && (bypass_surface_visibility || (!tree
-				|| wlr_scene_node_coords(&tree->node, &unused_lx, &unused_ly)))) {
-			inhibited = 1;
-			break;
-		}
-	}
-
-	wlr_idle_notifier_v1_set_inhibited(idle_notifier, inhibited);
+	wlr_session_change_vt(session, arg->ui);
 }
 
 void
 cleanup(void)
 {
+	Client *c;
+	Scraper *s, *tmp;
+	boostclient(NULL);
+	free(boost_threads);
+	free(tile_geom);
+	wl_list_for_each(c, &clients, link)
+		if (c->frozen)
+			thawclient(c);
+	wl_list_for_each_safe(s, tmp, &scrapers, link)
+		closescraper(s);
+	if (metrics_source) {
+		wl_event_source_remove(metrics_source);
+		close(metrics_fd);
+		unlink(metrics_path);
+		wl_list_remove(&metrics_timer.link);
+		wl_event_source_remove(metrics_timer.source);
+	}
+	if (record_file)
+		fclose(record_file);
+	if (replay_file)
+		fclose(replay_file);
+	if (replay_timer.source) {
+		wl_list_remove(&replay_timer.link);
+		wl_event_source_remove(replay_timer.source);
+		wlr_keyboard_finish(&replay_keyboard);
+		wlr_pointer_finish(&replay_pointer);
+	}
+
 #ifdef XWAYLAND
+	xwaylanddisconnect();
 	wlr_xwayland_destroy(xwayland);
 	xwayland = NULL;
 #endif
@@ -636,6 +1187,9 @@ cleanup(void)
 	wlr_xcursor_manager_destroy(cursor_mgr);
 	wlr_output_layout_destroy(output_layout);
 	wl_display_destroy(dpy);
+	if (input_dpy)
+		wl_display_destroy(input_dpy);
+	xkb_keymap_unref(shared_keymap);
 	/* Destroy after the wayland display (when the monitors are already destroyed)
 	   to avoid destroying them with an invalid scene output. */
 	wlr_scene_node_destroy(&scene->tree.node);
@@ -647,6 +1201,7 @@ cleanupkeyboard(struct wl_listener *listener, void *data)
 	Keyboard *kb = wl_container_of(listener, kb, destroy);
 
 	wl_event_source_remove(kb->key_repeat_source);
+	close(kb->key_repeat_fd);
 	wl_list_remove(&kb->link);
 	wl_list_remove(&kb->modifiers.link);
 	wl_list_remove(&kb->key.link);
@@ -661,6 +1216,7 @@ cleanupmon(struct wl_listener *listener, void *data)
 	LayerSurface *l, *tmp;
 	int i;
 
+	flight(FlightOutputGone, 0, 0, m->wlr_output->name);
 	for (i = 0; i <= ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY; i++)
 		wl_list_for_each_safe(l, tmp, &m->layers[i], link)
 			wlr_layer_surface_v1_destroy(l->layer_surface);
@@ -696,6 +1252,11 @@ closemon(Monitor *m)
 		if (c->isfloating && c->geom.x > m->m.width)
 			resize(c, (struct wlr_box){.x = c->geom.x - m->w.width, .y = c->geom.y,
 				.width = c->geom.width, .height = c->geom.height}, 0);
+#ifdef XWAYLAND
+		/* m won't render the frame they are waiting for */
+		if (c->mon == m && c->configurepending)
+			ackconfigurex11(c);
+#endif
 		if (c->mon == m)
 			setmon(c, selmon, c->tags);
 	}
@@ -703,6 +1264,18 @@ closemon(Monitor *m)
 	printstatus();
 }
 
+void
+closescraper(Scraper *s)
+{
+	wl_event_source_remove(s->source);
+	close(s->fd);
+	wl_list_remove(&s->link);
+	free(s->response);
+	free(s);
+	if (metrics_paused)
+		pausemetrics(0);
+}
+
 void
 commitlayersurfacenotify(struct wl_listener *listener, void *data)
 {
@@ -710,6 +1283,7 @@ commitlayersurfacenotify(struct wl_listener *listener, void *data)
 	struct wlr_layer_surface_v1 *wlr_layer_surface = layersurface->layer_surface;
 	struct wlr_output *wlr_output = wlr_layer_surface->output;
 	struct wlr_scene_tree *layer = layers[layermap[wlr_layer_surface->current.layer]];
+	uint64_t cpu = cputime();
 
 	/* For some reason this layersurface have no monitor, this can be because
 	 * its monitor has just been destroyed */
@@ -726,18 +1300,25 @@ commitlayersurfacenotify(struct wl_listener *listener, void *data)
 	if (wlr_layer_surface->current.layer < ZWLR_LAYER_SHELL_V1_LAYER_TOP)
 		wlr_scene_node_reparent(&layersurface->popups->node, layers[LyrTop]);
 
-	if (wlr_layer_surface->current.committed == 0
-			&& layersurface->mapped == wlr_layer_surface->surface->mapped)
-		return;
-	layersurface->mapped = wlr_layer_surface->surface->mapped;
-
-	arrangelayers(layersurface->mon);
+	if (wlr_layer_surface->current.committed != 0
+			|| layersurface->mapped != wlr_layer_surface->surface->mapped) {
+		layersurface->mapped = wlr_layer_surface->surface->mapped;
+		arrangelayers(layersurface->mon);
+	}
+	account(HandlerCommitLayer, cpu,
+			wl_resource_get_client(wlr_layer_surface->resource));
 }
 
 void
 commitnotify(struct wl_listener *listener, void *data)
 {
 	Client *c = wl_container_of(listener, c, commit);
+	struct wl_client *client = wl_resource_get_client(client_surface(c)->resource);
+	uint64_t cpu = cputime();
+	Peer *p;
+
+	if (!c->committime)
+		c->committime = monotime();
 
 	if (client_surface(c)->mapped)
 		resize(c, c->geom, (c->isfloating && !c->isfullscreen));
@@ -745,6 +1326,35 @@ commitnotify(struct wl_listener *listener, void *data)
 	/* mark a pending resize as completed */
 	if (c->resize && c->resize <= c->surface.xdg->current.configure_serial)
 		c->resize = 0;
+
+	/* Whether it hides the clients behind it may have changed (video
+	 * players, terminals toggling transparency), see arrange(). Some flip
+	 * it every frame, so outputs are arranged for it at most once per
+	 * occlusion_interval. */
+	if (client_surface(c)->mapped && client_is_opaque(c) != c->isopaque) {
+		c->isopaque = !c->isopaque;
+		if (canocclude(c) && occlusion_armed) {
+			c->mon->occlusionchanged = 1;
+		} else if (canocclude(c)) {
+			arrange(c->mon);
+			occlusion_armed = 1;
+			settimer(&occlusion_timer, MAX(occlusion_interval, 1));
+		}
+	}
+
+	if ((p = getpeer(client))) {
+		p->buffer_width = client_surface(c)->current.buffer_width;
+		p->buffer_height = client_surface(c)->current.buffer_height;
+	}
+	account(HandlerCommit, cpu, client);
+}
+
+uint64_t
+cputime(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
 }
 
 void
@@ -758,29 +1368,25 @@ void
 createidleinhibitor(struct wl_listener *listener, void *data)
 {
 	struct wlr_idle_inhibitor_v1 *idle_inhibitor = data;
-	LISTEN_STATIC(&idle_inhibitor->events.destroy, destroyidleinhibitor);
+	Inhibitor *inhibitor = ecalloc(1, sizeof(*inhibitor));
+	inhibitor->inhibitor = idle_inhibitor;
+	LISTEN(&idle_inhibitor->events.destroy, &inhibitor->destroy, destroyidleinhibitor);
+	wl_list_insert(&inhibitors, &inhibitor->link);
 
-	checkidleinhibitor(NULL);
+	updateidleinhibitors(wlr_surface_get_root_surface(idle_inhibitor->surface), 0);
 }
 
 void
 createkeyboard(struct wlr_keyboard *keyboard)
 {
-	struct xkb_context *context;
-	struct xkb_keymap *keymap;
 	Keyboard *kb = keyboard->data = ecalloc(1, sizeof(*kb));
 	kb->wlr_keyboard = keyboard;
 
-	/* Prepare an XKB keymap and assign it to the keyboard. */
-	context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-	keymap = xkb_keymap_new_from_names(context, &xkb_rules,
-		XKB_KEYMAP_COMPILE_NO_FLAGS);
-	if (!keymap)
+	/* All keyboards share the same keymap, only compile it once. */
+	if (!shared_keymap && !(shared_keymap = loadkeymap()))
 		die("createkeyboard: failed to compile keymap");
 
-	wlr_keyboard_set_keymap(keyboard, keymap);
-	xkb_keymap_unref(keymap);
-	xkb_context_unref(context);
+	wlr_keyboard_set_keymap(keyboard, shared_keymap);
 	wlr_keyboard_set_repeat_info(keyboard, repeat_rate, repeat_delay);
 
 	/* Here we set up listeners for keyboard events. */
@@ -790,8 +1396,11 @@ createkeyboard(struct wlr_keyboard *keyboard)
 
 	wlr_seat_set_keyboard(seat, keyboard);
 
-	kb->key_repeat_source = wl_event_loop_add_timer(
-			wl_display_get_event_loop(dpy), keyrepeat, kb);
+	if ((kb->key_repeat_fd = timerfd_create(CLOCK_MONOTONIC,
+			TFD_CLOEXEC | TFD_NONBLOCK)) < 0)
+		die("createkeyboard: timerfd_create:");
+	kb->key_repeat_source = wl_event_loop_add_fd(wl_display_get_event_loop(dpy),
+			kb->key_repeat_fd, WL_EVENT_READABLE, keyrepeat, kb);
 
 	/* And add the keyboard to our list of keyboards */
 	wl_list_insert(&keyboards, &kb->link);
@@ -984,6 +1593,18 @@ createnotify(struct wl_listener *listener, void *data)
 			fullscreennotify);
 	LISTEN(&xdg_surface->toplevel->events.request_maximize, &c->maximize,
 			maximizenotify);
+	LISTEN(&xdg_surface->events.ping_timeout, &c->ping_timeout, pingtimeout);
+}
+
+void
+createpeer(struct wl_listener *listener, void *data)
+{
+	struct wl_client *client = data;
+	Peer *p = ecalloc(1, sizeof(*p));
+	p->client = client;
+	p->destroy.notify = destroypeer;
+	wl_client_add_destroy_listener(client, &p->destroy);
+	wl_list_insert(&peers, &p->link);
 }
 
 void
@@ -1030,6 +1651,16 @@ createpointer(struct wlr_pointer *pointer)
 	wlr_cursor_attach_input_device(cursor, &pointer->base);
 }
 
+void
+crash(int signo)
+{
+	/* Installed with SA_RESETHAND, so raising the signal again once the
+	 * flight recorder is out kills dwl as it would have, core dump included */
+	dumpflight(signo);
+	thawall();
+	raise(signo);
+}
+
 void
 cursorframe(struct wl_listener *listener, void *data)
 {
@@ -1052,9 +1683,26 @@ destroydragicon(struct wl_listener *listener, void *data)
 void
 destroyidleinhibitor(struct wl_listener *listener, void *data)
 {
-	/* `data` is the wlr_surface of the idle inhibitor being destroyed,
-	 * at this point the idle inhibitor is still in the list of the manager */
-	checkidleinhibitor(wlr_surface_get_root_surface(data));
+	Inhibitor *inhibitor = wl_container_of(listener, inhibitor, destroy);
+	if (inhibitor->visible && !--ninhibiting)
+		wlr_idle_notifier_v1_set_inhibited(idle_notifier, 0);
+	wl_list_remove(&inhibitor->destroy.link);
+	wl_list_remove(&inhibitor->link);
+	free(inhibitor);
+}
+
+void
+destroylaunch(struct wl_listener *listener, void *data)
+{
+	Launch *l = wl_container_of(listener, l, destroy);
+	/* Windows mapped from now on can only be matched by pid, and the token
+	 * can no longer activate them */
+	if (running && !l->pool && monotime() - l->time
+			>= activation->token_timeout_msec * (uint64_t)1000000)
+		tokens_expired++;
+	wl_list_remove(&l->destroy.link);
+	wl_list_remove(&l->link);
+	free(l);
 }
 
 void
@@ -1079,6 +1727,7 @@ destroylock(SessionLock *lock, int unlock)
 		goto destroy;
 
 	wlr_scene_node_set_enabled(&locked_bg->node, 0);
+	suspendscene(0);
 
 	focusclient(focustop(selmon), 0);
 	motionnotify(0);
@@ -1120,9 +1769,11 @@ destroynotify(struct wl_listener *listener, void *data)
 {
 	/* Called when the xdg_toplevel is destroyed. */
 	Client *c = wl_container_of(listener, c, destroy);
+	uint64_t start = monotime();
 	wl_list_remove(&c->destroy.link);
 	wl_list_remove(&c->set_title.link);
 	wl_list_remove(&c->fullscreen.link);
+	wl_list_remove(&c->ping_timeout.link);
 #ifdef XWAYLAND
 	if (c->type != XDGShell) {
 		wl_list_remove(&c->activate.link);
@@ -1130,6 +1781,8 @@ destroynotify(struct wl_listener *listener, void *data)
 		wl_list_remove(&c->configure.link);
 		wl_list_remove(&c->dissociate.link);
 		wl_list_remove(&c->set_hints.link);
+		if (!--nxclients && xwayland_idle)
+			settimer(&xwayland_timer, xwayland_idle);
 	} else
 #endif
 	{
@@ -1138,6 +1791,20 @@ destroynotify(struct wl_listener *listener, void *data)
 		wl_list_remove(&c->unmap.link);
 	}
 	free(c);
+	histadd(&destroy_time, (monotime() - start) / 1000);
+}
+
+void
+destroypeer(struct wl_listener *listener, void *data)
+{
+	Peer *p = wl_container_of(listener, p, destroy);
+	unhold(&p->selection);
+	unhold(&p->primary_selection);
+	unhold(&p->cursor);
+	unhold(&p->activation);
+	wl_list_remove(&p->destroy.link);
+	wl_list_remove(&p->link);
+	free(p);
 }
 
 void
@@ -1170,6 +1837,219 @@ dirtomon(enum wlr_direction dir)
 	return selmon;
 }
 
+int
+dispatchinput(int fd, uint32_t mask, void *data)
+{
+	wl_event_loop_dispatch(wl_display_get_event_loop(input_dpy), 0);
+	return 0;
+}
+
+void
+dumpflight(int signo)
+{
+	/* Write the events in flight_ring to flight_path. This runs from crash()
+	 * too, so only async-signal-safe functions are allowed: no stdio, no
+	 * malloc, no locks. */
+	char line[128], *p;
+	unsigned long n = flight_n, i;
+	FlightEvent *e;
+	int fd;
+
+	atomic_signal_fence(memory_order_acquire);
+	if (!n || !flight_path[0] || (fd = open(flight_path,
+			O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600)) < 0)
+		return;
+
+	p = fmtstr(line, signo ? "dwl crashed, signal " : "dwl exited on an error");
+	if (signo)
+		p = fmtnum(p, signo);
+	p = fmtstr(fmtnum(fmtstr(p, ", time_us "), monotime() / 1000), "\n");
+
+	/* Each line is written before formatting the next one. The oldest slot
+	 * is skipped: if flight() was interrupted while filling it for a new
+	 * event, it holds half of each. */
+	for (i = n > LENGTH(flight_ring) ? n - LENGTH(flight_ring) + 1 : 0;
+			write(fd, line, p - line) >= 0 && i < n; i++) {
+		e = &flight_ring[i % LENGTH(flight_ring)];
+		p = fmtstr(fmtnum(line, e->time / 1000), " ");
+		p = fmtstr(p, e->type < LENGTH(flight_names) ? flight_names[e->type] : "?");
+		p = fmtnum(fmtstr(p, " "), e->a);
+		p = fmtnum(fmtstr(p, " "), e->b);
+		p = fmtstr(fmtstr(fmtstr(p, " "), e->text), "\n");
+	}
+	close(fd);
+}
+
+int
+dumpstats(int signo, void *data)
+{
+	LaunchStats *s;
+	Client *c;
+	Peer *p;
+	pid_t pid;
+	struct rusage ru;
+	Monitor *m;
+	FILE *f;
+	unsigned long rss;
+	size_t i;
+	int nlayers;
+
+	/* Monotonic time, so that successive dumps give rates, see dwl-top */
+	fprintf(stderr, "time_us %llu\n", (unsigned long long)(monotime() / 1000));
+
+	/* CPU time since startup or the last resetstats() */
+	getrusage(RUSAGE_SELF, &ru);
+	fprintf(stderr, "cpu user_us %llu sys_us %llu\n",
+			(unsigned long long)(TVUSEC(ru.ru_utime) - TVUSEC(stats_rusage.ru_utime)),
+			(unsigned long long)(TVUSEC(ru.ru_stime) - TVUSEC(stats_rusage.ru_stime)));
+	printhist("frame", &frame_time);
+	printhist("arrange", &arrange_time);
+	printhist("arrangelayers", &arrangelayers_time);
+	printhist("map", &map_time);
+	printhist("unmap", &unmap_time);
+	printhist("destroy", &destroy_time);
+	for (i = 0; i < LENGTH(handler_names); i++)
+		fprintf(stderr, "handler %s calls %llu cpu_us %llu\n", handler_names[i],
+				(unsigned long long)handler_calls[i],
+				(unsigned long long)(handler_cpu[i] / 1000));
+	wl_list_for_each(m, &mons, link)
+		fprintf(stderr, "output %s cpu_us %llu\n", m->wlr_output->name,
+				(unsigned long long)(m->cpu / 1000));
+	for (i = 0; i < LENGTH(input_latency); i++) {
+		if (!input_latency[i].count && !input_cpu[i].count)
+			continue;
+		fprintf(stderr, "input %s ", input_names[i]);
+		printhist("latency", &input_latency[i]);
+		fprintf(stderr, "input %s ", input_names[i]);
+		printhist("cpu", &input_cpu[i]);
+	}
+
+	/* Steady growth across runs of the same workload means a leak */
+	if ((f = fopen("/proc/self/statm", "re"))) {
+		if (fscanf(f, "%*lu %lu", &rss) == 1)
+			fprintf(stderr, "memory rss_kb %lu\n", rss * (sysconf(_SC_PAGESIZE) / 1024));
+		fclose(f);
+	}
+	nlayers = 0;
+	wl_list_for_each(m, &mons, link)
+		for (i = 0; i < LENGTH(m->layers); i++)
+			nlayers += wl_list_length(&m->layers[i]);
+	fprintf(stderr, "objects clients %d layers %d launches %d peers %d inhibitors %d\n",
+			wl_list_length(&clients), nlayers, wl_list_length(&launches),
+			wl_list_length(&peers), wl_list_length(&inhibitors));
+
+	wl_list_for_each(s, &launchstats, link) {
+		fprintf(stderr, "launch %s ", s->appid);
+		printhist("commit", &s->commit);
+		fprintf(stderr, "launch %s ", s->appid);
+		printhist("map", &s->map);
+	}
+	fprintf(stderr, "pool hits %u misses %u\n", pool_hits, pool_misses);
+	fprintf(stderr, "tokens expired %u\n", tokens_expired);
+#ifdef XWAYLAND
+	fprintf(stderr, "xwayland stops %u kills %u\n", xwayland_stops, xwayland_kills);
+#endif
+	fprintf(stderr, "keyrepeat skipped %llu ", (unsigned long long)repeat_skipped);
+	printhist("lateness", &repeat_lateness);
+	wl_list_for_each(c, &clients, link) {
+		if (c->isunresponsive)
+			fprintf(stderr, "unresponsive %d %s\n", (int)client_get_pid(c),
+					client_get_appid(c) ? client_get_appid(c) : broken);
+#ifdef XWAYLAND
+		if (c->nconfigure)
+			fprintf(stderr, "configure %s requests %u coalesced %u\n",
+					client_get_appid(c) ? client_get_appid(c) : broken,
+					c->nconfigure, c->ncoalesced);
+#endif
+	}
+	wl_list_for_each(p, &peers, link) {
+		wl_client_get_credentials(p->client, &pid, NULL, NULL);
+		fprintf(stderr, "client %d requests %llu commits %llu frames %llu cpu_us %llu"
+				" buffer %dx%d throttled %llu%s\n",
+				(int)pid, (unsigned long long)p->total_requests,
+				(unsigned long long)p->total_commits, (unsigned long long)p->frames,
+				(unsigned long long)(p->cpu / 1000), p->buffer_width, p->buffer_height,
+				(unsigned long long)p->nthrottled, p->throttled ? " now" : "");
+	}
+	return 0;
+}
+
+void
+findheadlessbackend(struct wlr_backend *b, void *data)
+{
+	if (wlr_backend_is_headless(b))
+		headless_backend = b;
+}
+
+void
+findinputbackend(struct wlr_backend *b, void *data)
+{
+	struct wlr_backend **input_backend = data;
+	if (wlr_backend_is_libinput(b))
+		*input_backend = b;
+}
+
+int
+findxkbcommon(struct dl_phdr_info *info, size_t size, void *data)
+{
+	/* Find the file libxkbcommon was loaded from, see loadkeymap() */
+	if (!strstr(info->dlpi_name, "/libxkbcommon.so"))
+		return 0;
+	snprintf(data, PATH_MAX, "%s", info->dlpi_name);
+	return 1;
+}
+
+void
+flight(unsigned int type, uint32_t a, uint32_t b, const char *text)
+{
+	/* Record an event in the flight recorder, a ring of the last events
+	 * written out by dumpflight() when dwl crashes. This is cheap enough to
+	 * stay enabled: no allocation, no locking, no I/O. */
+	FlightEvent *e = &flight_ring[flight_n % LENGTH(flight_ring)];
+	e->time = monotime();
+	e->type = type;
+	e->a = a;
+	e->b = b;
+	strncpy(e->text, text ? text : "", sizeof(e->text) - 1);
+	e->text[sizeof(e->text) - 1] = '\0';
+	/* Only count the event once it's complete, in case of a signal */
+	atomic_signal_fence(memory_order_release);
+	flight_n++;
+}
+
+void
+flightatexit(void)
+{
+	/* exit() while still running means die(), which only reports its
+	 * message; add what led to it */
+	if (running) {
+		dumpflight(0);
+		thawall();
+	}
+}
+
+char *
+fmtnum(char *p, uint64_t n)
+{
+	/* Async-signal-safe number formatting for dumpflight() */
+	char buf[20];
+	int i = 0;
+	do
+		buf[i++] = '0' + n % 10;
+	while (n /= 10);
+	while (i)
+		*p++ = buf[--i];
+	return p;
+}
+
+char *
+fmtstr(char *p, const char *s)
+{
+	while (*s)
+		*p++ = *s++;
+	return p;
+}
+
 void
 focusclient(Client *c, int lift)
 {
@@ -1187,6 +2067,7 @@ focusclient(Client *c, int lift)
 
 	if (c && client_surface(c) == old)
 		return;
+	flight(FlightFocus, c ? c->tags : 0, 0, c ? client_get_appid(c) : NULL);
 
 	if ((old_client_type = toplevel_from_wlr_surface(old, &old_c, &old_l)) == XDGShell) {
 		struct wlr_xdg_popup *popup, *tmp;
@@ -1201,11 +2082,19 @@ focusclient(Client *c, int lift)
 		selmon = c->mon;
 		c->isurgent = 0;
 		client_restack_surface(c);
+		boostclient(c);
+		/* Show it if it was hidden by the one on top */
+		if (c->isoccluded)
+			arrange(c->mon);
 
 		/* Don't change border color if there is an exclusive focus or we are
 		 * handling a drag operation */
 		if (!exclusive_focus && !seat->drag)
-			client_set_border_color(c, focuscolor);
+			client_set_border_color(c, c->isunresponsive ? unresponsivecolor : focuscolor);
+	} else if (!c) {
+		/* Nothing is focused, so nothing is boosted. Unmanaged surfaces
+		 * (menus, tooltips) don't get here, their parent keeps the boost. */
+		boostclient(NULL);
 	}
 
 	/* Deactivate old client if focus is changing */
@@ -1222,7 +2111,8 @@ focusclient(Client *c, int lift)
 		/* Don't deactivate old client if the new one wants focus, as this causes issues with winecfg
 		 * and probably other clients */
 		} else if (old_c && !client_is_unmanaged(old_c) && (!c || !client_wants_focus(c))) {
-			client_set_border_color(old_c, bordercolor);
+			client_set_border_color(old_c, old_c->isunresponsive
+					? unresponsivecolor : bordercolor);
 
 			client_activate_surface(old, 0);
 		}
@@ -1295,6 +2185,85 @@ focustop(Monitor *m)
 	return NULL;
 }
 
+void
+freezeclient(Client *c)
+{
+	/* Stop the process behind c with the cgroup v2 freezer if it has a
+	 * cgroup of its own, see isowncgroup(), or SIGSTOP. This also freezes
+	 * all its other windows, so none of them may be visible. */
+	char cgroup[PATH_MAX], own[PATH_MAX];
+	Client *o;
+	pid_t pid = client_get_pid(c);
+	int how = FreezeSignal;
+
+	if (pid <= 0 || pid == getpid())
+		return;
+	if (!getcgroup(pid, cgroup, sizeof(cgroup)) && !getcgroup(getpid(), own, sizeof(own))
+			&& strcmp(cgroup, own) && isowncgroup(cgroup, pid))
+		how = FreezeCgroup;
+
+	wl_list_for_each(o, &clients, link)
+		if (VISIBLEON(o, o->mon) && sharesprocess(o, pid, how == FreezeCgroup ? cgroup : NULL))
+			return;
+
+	if (how == FreezeCgroup && freezeprocess(pid, cgroup) < 0)
+		how = FreezeSignal;
+	if (how == FreezeSignal && freezeprocess(pid, NULL) < 0)
+		return;
+	wl_list_for_each(o, &clients, link)
+		if (sharesprocess(o, pid, how == FreezeCgroup ? cgroup : NULL))
+			o->frozen = how;
+}
+
+int
+freezeclients(void *data)
+{
+	Client *c;
+	uint64_t now = monotime(), due, next = 0;
+
+	freeze_deadline = 0;
+	wl_list_for_each(c, &clients, link) {
+		if (!c->freeze || c->frozen || !c->hiddensince || VISIBLEON(c, c->mon))
+			continue;
+		if ((due = c->hiddensince + freeze_delay * 1000000ull) <= now)
+			freezeclient(c);
+		else if (!next || due < next)
+			next = due;
+	}
+
+	if (next) {
+		freeze_deadline = next;
+		settimer(&freeze_timer, (next - now) / 1000000 + 1);
+	}
+	return 0;
+}
+
+int
+freezeprocess(pid_t pid, const char *cgroup)
+{
+	/* Freeze cgroup if given, or stop pid, and remember it in frozen[]
+	 * before, so that thawall() can undo it whenever dwl goes away */
+	char path[PATH_MAX + 16];
+	Frozen *f;
+
+	for (f = frozen; f < frozen + LENGTH(frozen) && f->pid; f++);
+	if (f == frozen + LENGTH(frozen))
+		return -1;
+	f->fd = -1;
+	if (cgroup) {
+		snprintf(path, sizeof(path), "%s/cgroup.freeze", cgroup);
+		if ((f->fd = open(path, O_WRONLY | O_CLOEXEC)) < 0)
+			return -1;
+	}
+	f->pid = pid;
+	if (f->fd >= 0 ? write(f->fd, "1", 1) == 1 : !kill(pid, SIGSTOP))
+		return 0;
+	if (f->fd >= 0)
+		close(f->fd);
+	f->pid = 0;
+	return -1;
+}
+
 void
 fullscreennotify(struct wl_listener *listener, void *data)
 {
@@ -1302,6 +2271,39 @@ fullscreennotify(struct wl_listener *listener, void *data)
 	setfullscreen(c, client_wants_fullscreen(c));
 }
 
+int
+getcgroup(pid_t pid, char *buf, size_t len)
+{
+	/* Path of the cgroup v2 directory pid belongs to */
+	char line[PATH_MAX], *nl;
+	int ret = -1;
+	FILE *f;
+
+	snprintf(line, sizeof(line), "/proc/%d/cgroup", (int)pid);
+	if (!(f = fopen(line, "re")))
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "0::/", 4))
+			continue;
+		if ((nl = strchr(line, '\n')))
+			*nl = '\0';
+		snprintf(buf, len, "/sys/fs/cgroup%s", line + 3);
+		ret = 0;
+		break;
+	}
+	fclose(f);
+	return ret;
+}
+
+Peer *
+getpeer(struct wl_client *client)
+{
+	Peer *p;
+	struct wl_listener *l = client
+		? wl_client_get_destroy_listener(client, destroypeer) : NULL;
+	return l ? wl_container_of(l, p, destroy) : NULL;
+}
+
 void
 handlesig(int signo)
 {
@@ -1323,24 +2325,89 @@ handlesig(int signo)
 	}
 }
 
-void
-incnmaster(const Arg *arg)
+uint32_t
+hashbytes(uint32_t hash, const void *data, size_t len)
 {
-	if (!arg || !selmon)
-		return;
-	selmon->nmaster = MAX(selmon->nmaster + arg->i, 0);
-	arrange(selmon);
+	/* FNV-1a */
+	const unsigned char *p = data;
+	while (len--)
+		hash = (hash ^ *p++) * 16777619u;
+	return hash;
 }
 
 void
-inputdevice(struct wl_listener *listener, void *data)
+histadd(Histogram *h, uint64_t usec)
 {
-	/* This event is raised by the backend when a new input device becomes
-	 * available. */
-	struct wlr_input_device *device = data;
-	uint32_t caps;
+	size_t i;
+	for (i = 0; i < LENGTH(h->bucket) - 1 && usec >> i; i++);
+	h->bucket[i]++;
+	h->count++;
+	h->sum += usec;
+}
 
-	switch (device->type) {
+void
+hold(Held *h, void *ptr, struct wl_signal *destroy)
+{
+	/* Keep ptr, which may be NULL, until unhold() or until the object is
+	 * destroyed, if destroy is given */
+	unhold(h);
+	h->ptr = ptr;
+	h->held = 1;
+	if (destroy) {
+		h->destroy.notify = holddestroy;
+		wl_signal_add(destroy, &h->destroy);
+	}
+}
+
+void
+holddestroy(struct wl_listener *listener, void *data)
+{
+	/* A request about an object that is gone is void */
+	Held *h = wl_container_of(listener, h, destroy);
+	unhold(h);
+}
+
+int
+hotplug(int signo, void *data)
+{
+	/* Plug in a new headless output, or unplug the last one added. The last
+	 * output is left alone, as a real one would be. */
+	Monitor *m;
+	if (signo == SIGRTMIN) {
+		if (!wlr_headless_add_output(headless_backend, 1280, 720))
+			wlr_log(WLR_ERROR, "failed to add a headless output");
+		return 0;
+	}
+	if (wl_list_length(&mons) < 2)
+		return 0;
+	/* createmon() inserts at the head */
+	wl_list_for_each(m, &mons, link) {
+		if (wlr_output_is_headless(m->wlr_output)) {
+			wlr_output_destroy(m->wlr_output);
+			break;
+		}
+	}
+	return 0;
+}
+
+void
+incnmaster(const Arg *arg)
+{
+	if (!arg || !selmon)
+		return;
+	selmon->nmaster = MAX(selmon->nmaster + arg->i, 0);
+	arrange(selmon);
+}
+
+void
+inputdevice(struct wl_listener *listener, void *data)
+{
+	/* This event is raised by the backend when a new input device becomes
+	 * available. */
+	struct wlr_input_device *device = data;
+	uint32_t caps;
+
+	switch (device->type) {
 	case WLR_INPUT_DEVICE_KEYBOARD:
 		createkeyboard(wlr_keyboard_from_input_device(device));
 		break;
@@ -1362,6 +2429,37 @@ inputdevice(struct wl_listener *listener, void *data)
 	wlr_seat_set_capabilities(seat, caps);
 }
 
+int
+isowncgroup(const char *cgroup, pid_t pid)
+{
+	/* Whether freezing cgroup only stops the application behind pid: pid
+	 * is all it holds. Shared cgroups, such as a session scope, dbus.service
+	 * or an app scope with helpers, are not. */
+	char path[PATH_MAX + 16];
+	int self = 0, other = 0;
+	long p;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/cgroup.procs", cgroup);
+	if (!(f = fopen(path, "re")))
+		return 0;
+	while (fscanf(f, "%ld", &p) == 1) {
+		if (p == pid)
+			self = 1;
+		else
+			other = 1;
+	}
+	fclose(f);
+	return self && !other;
+}
+
+int
+isthrottled(struct wl_client *client)
+{
+	Peer *p = getpeer(client);
+	return p && p->throttled;
+}
+
 int
 keybinding(uint32_t mods, xkb_keysym_t sym)
 {
@@ -1399,7 +2497,9 @@ keypress(struct wl_listener *listener, void *data)
 
 	int handled = 0;
 	uint32_t mods = wlr_keyboard_get_modifiers(kb->wlr_keyboard);
+	uint64_t cpu = cputime();
 
+	noteinput(InputKey, event->keycode, event->state, 0, 0, 0, 0);
 	wlr_idle_notifier_v1_notify_activity(idle_notifier, seat);
 
 	/* On _press_ if there is no active screen locker,
@@ -1412,20 +2512,21 @@ keypress(struct wl_listener *listener, void *data)
 		kb->mods = mods;
 		kb->keysyms = syms;
 		kb->nsyms = nsyms;
-		wl_event_source_timer_update(kb->key_repeat_source,
-				kb->wlr_keyboard->repeat_info.delay);
+		kb->repeat_start = monotime()
+			+ kb->wlr_keyboard->repeat_info.delay * 1000000ull;
+		kb->repeat_n = 0;
 	} else {
 		kb->nsyms = 0;
-		wl_event_source_timer_update(kb->key_repeat_source, 0);
 	}
-
-	if (handled)
-		return;
+	armkeyrepeat(kb);
 
 	/* Pass unhandled keycodes along to the client. */
-	wlr_seat_set_keyboard(seat, kb->wlr_keyboard);
-	wlr_seat_keyboard_notify_key(seat, event->time_msec,
-		event->keycode, event->state);
+	if (!handled) {
+		wlr_seat_set_keyboard(seat, kb->wlr_keyboard);
+		wlr_seat_keyboard_notify_key(seat, event->time_msec,
+			event->keycode, event->state);
+	}
+	account(HandlerKey, cpu, FOCUSED(seat->keyboard_state));
 }
 
 void
@@ -1447,15 +2548,28 @@ keypressmod(struct wl_listener *listener, void *data)
 }
 
 int
-keyrepeat(void *data)
+keyrepeat(int fd, uint32_t mask, void *data)
 {
 	Keyboard *kb = data;
-	int i;
-	if (!kb->nsyms || kb->wlr_keyboard->repeat_info.rate <= 0)
+	uint64_t expirations, now, due;
+	int i, rate = kb->wlr_keyboard->repeat_info.rate;
+
+	if ((fd >= 0 && read(fd, &expirations, sizeof(expirations)) < 0)
+			|| !kb->nsyms || rate <= 0)
 		return 0;
 
-	wl_event_source_timer_update(kb->key_repeat_source,
-			1000 / kb->wlr_keyboard->repeat_info.rate);
+	now = monotime();
+	due = kb->repeat_start + kb->repeat_n * 1000000000ull / rate;
+	histadd(&repeat_lateness, now > due ? (now - due) / 1000 : 0);
+
+	/* If we are late, drop the repeats we missed rather than firing them
+	 * all at once, and stay on the original schedule */
+	kb->repeat_n++;
+	while (kb->repeat_start + kb->repeat_n * 1000000000ull / rate <= now) {
+		kb->repeat_n++;
+		repeat_skipped++;
+	}
+	armkeyrepeat(kb);
 
 	for (i = 0; i < kb->nsyms; i++)
 		keybinding(kb->mods, kb->keysyms[i]);
@@ -1471,6 +2585,247 @@ killclient(const Arg *arg)
 		client_send_close(sel);
 }
 
+pid_t
+launch(char *const argv[], char *const envp[], int infd, int outfd, int newsession)
+{
+	/* posix_spawn(3) creates the child with vfork semantics (clone with
+	 * CLONE_VM|CLONE_VFORK on Linux), so unlike fork() it does not copy our
+	 * page tables and its cost does not grow with the compositor's RSS. */
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+	pid_t pid;
+	int err;
+
+	/* Don't leak DRM, input or client fds to the child */
+	setcloexec();
+
+	posix_spawn_file_actions_init(&actions);
+	if (infd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, infd, STDIN_FILENO);
+	if (outfd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, outfd, STDOUT_FILENO);
+
+	/* Reset the signal mask and every handler installed by setup() */
+	posix_spawnattr_init(&attr);
+	sigemptyset(&sigs);
+	posix_spawnattr_setsigmask(&attr, &sigs);
+	sigfillset(&sigs);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+	if (newsession)
+#ifdef POSIX_SPAWN_SETSID
+		flags |= POSIX_SPAWN_SETSID;
+#else
+		flags |= POSIX_SPAWN_SETPGROUP;
+#endif
+	posix_spawnattr_setflags(&attr, flags);
+
+	if ((err = posix_spawnp(&pid, argv[0], &actions, &attr, argv,
+			envp ? envp : environ))) {
+		fprintf(stderr, "dwl: posix_spawnp %s failed: %s\n", argv[0], strerror(err));
+		pid = -1;
+	}
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	return pid;
+}
+
+Launch *
+launchfind(pid_t pid)
+{
+	/* Find the spawn() that started pid, either directly or through a
+	 * wrapper that passed our activation token on in its environment */
+	Launch *l, *found = NULL;
+	char path[64], *env = NULL, *tmp, *p;
+	size_t n = 0, size = 0;
+	ssize_t r;
+	int fd;
+
+	if (wl_list_empty(&launches))
+		return NULL;
+	wl_list_for_each(l, &launches, link)
+		if (l->pid == pid)
+			return l;
+
+	snprintf(path, sizeof(path), "/proc/%d/environ", (int)pid);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return NULL;
+	/* The environment has no size limit and wrappers tend to grow it */
+	for (;;) {
+		if (size - n < 4096) {
+			if (!(tmp = realloc(env, size + 8192)))
+				break;
+			env = tmp;
+			size += 8192;
+		}
+		if ((r = read(fd, env + n, size - n - 1)) > 0)
+			n += r;
+		else if (!r || errno != EINTR)
+			break;
+	}
+	close(fd);
+	if (!env)
+		return NULL;
+	env[n] = '\0';
+
+	for (p = env; p < env + n; p += strlen(p) + 1) {
+		if (strncmp(p, "XDG_ACTIVATION_TOKEN=", 21))
+			continue;
+		wl_list_for_each(l, &launches, link)
+			if (!strcmp(wlr_xdg_activation_token_v1_get_name(l->token), p + 21))
+				found = l;
+		break;
+	}
+	free(env);
+	return found;
+}
+
+void
+launchrecord(Client *c, uint64_t spawntime)
+{
+	LaunchStats *s;
+	const char *appid = client_get_appid(c);
+
+	if (!appid)
+		appid = broken;
+	c->spawntime = spawntime;
+	wl_list_for_each(s, &launchstats, link)
+		if (!strcmp(s->appid, appid))
+			goto found;
+	s = ecalloc(1, sizeof(*s));
+	s->appid = strdup(appid);
+	wl_list_insert(&launchstats, &s->link);
+
+found:
+	if (c->committime > spawntime)
+		histadd(&s->commit, (c->committime - spawntime) / 1000);
+	histadd(&s->map, (c->maptime - spawntime) / 1000);
+}
+
+void
+listenmetrics(const char *display)
+{
+	/* Serve metrics on a socket next to the Wayland one, see metricsserve() */
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if ((size_t)snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s.metrics",
+			getenv("XDG_RUNTIME_DIR"), display) >= sizeof(addr.sun_path)) {
+		wlr_log(WLR_ERROR, "metrics socket path too long");
+		return;
+	}
+	unlink(addr.sun_path);
+	if ((metrics_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) < 0
+			|| bind(metrics_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+			|| listen(metrics_fd, 8) < 0) {
+		wlr_log(WLR_ERROR, "cannot listen on %s: %s", addr.sun_path, strerror(errno));
+		if (metrics_fd >= 0)
+			close(metrics_fd);
+		metrics_fd = -1;
+		return;
+	}
+	strcpy(metrics_path, addr.sun_path);
+	metrics_source = wl_event_loop_add_fd(wl_display_get_event_loop(dpy), metrics_fd,
+			WL_EVENT_READABLE, metricsaccept, NULL);
+	addtimer(&metrics_timer, metricstimeout, NULL);
+}
+
+struct xkb_keymap *
+loadkeymap(void)
+{
+	/* Compiling a keymap from its RMLVO names means reading and resolving
+	 * dozens of XKB files. Keep the compiled result in the cache directory,
+	 * keyed by the names, so that later runs only parse a single file. The
+	 * key also covers the XKB directories and the libxkbcommon library,
+	 * so that upgrading either or adding XKB files makes a new one. */
+	const char *names[] = { xkb_rules.rules, xkb_rules.model,
+		xkb_rules.layout, xkb_rules.variant, xkb_rules.options };
+	const char *envs[] = { "XKB_DEFAULT_RULES", "XKB_DEFAULT_MODEL",
+		"XKB_DEFAULT_LAYOUT", "XKB_DEFAULT_VARIANT", "XKB_DEFAULT_OPTIONS" };
+	const char *subdirs[] = { "", "/rules", "/keycodes", "/types", "/compat", "/symbols" };
+	struct xkb_context *context;
+	struct xkb_keymap *keymap = NULL;
+	char dir[PATH_MAX - 64], path[PATH_MAX - 32], tmp[PATH_MAX], *str;
+	const char *base = NULL, *p;
+	uint32_t hash = 2166136261u; /* see hashbytes() */
+	struct stat st;
+	FILE *f;
+	size_t i, j;
+	long len;
+	int written;
+
+	if (!(context = xkb_context_new(XKB_CONTEXT_NO_FLAGS)))
+		return NULL;
+	if (!keymap_cache)
+		goto compile;
+
+	/* Empty names are taken from the environment by libxkbcommon */
+	for (i = 0; i < LENGTH(names); i++) {
+		if ((p = names[i] && *names[i] ? names[i] : getenv(envs[i])))
+			hash = hashbytes(hash, p, strlen(p));
+		hash = hashbytes(hash, "\n", 1);
+	}
+
+	/* Adding, removing or replacing an XKB file changes the modification
+	 * time of its directory. Editing one in place doesn't, see config.h. */
+	for (i = 0; i < xkb_context_num_include_paths(context); i++) {
+		for (j = 0; j < LENGTH(subdirs); j++) {
+			snprintf(tmp, sizeof(tmp), "%s%s",
+					xkb_context_include_path_get(context, i), subdirs[j]);
+			hash = hashbytes(hash, tmp, strlen(tmp));
+			if (!stat(tmp, &st))
+				hash = hashbytes(hash, &st.st_mtim, sizeof(st.st_mtim));
+		}
+	}
+	if (dl_iterate_phdr(findxkbcommon, tmp) && !stat(tmp, &st)) {
+		hash = hashbytes(hash, &st.st_mtim, sizeof(st.st_mtim));
+		hash = hashbytes(hash, &st.st_size, sizeof(st.st_size));
+	}
+
+	if ((base = getenv("XDG_CACHE_HOME")) && *base) {
+		snprintf(dir, sizeof(dir), "%s/dwl", base);
+	} else if ((base = getenv("HOME"))) {
+		snprintf(dir, sizeof(dir), "%s/.cache", base);
+		mkdir(dir, 0755);
+		snprintf(dir, sizeof(dir), "%s/.cache/dwl", base);
+	} else {
+		goto compile;
+	}
+	snprintf(path, sizeof(path), "%s/keymap-%08x.xkb", dir, hash);
+
+	if ((f = fopen(path, "r"))) {
+		if (!fseek(f, 0, SEEK_END) && (len = ftell(f)) > 0 && !fseek(f, 0, SEEK_SET)) {
+			str = ecalloc(1, len + 1);
+			if (fread(str, 1, len, f) == (size_t)len)
+				keymap = xkb_keymap_new_from_string(context, str,
+						XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+			free(str);
+		}
+		fclose(f);
+		if (keymap)
+			goto out;
+	}
+
+compile:
+	if (!(keymap = xkb_keymap_new_from_names(context, &xkb_rules,
+			XKB_KEYMAP_COMPILE_NO_FLAGS)) || !keymap_cache || !base)
+		goto out;
+
+	/* Write the cache atomically, another dwl might be reading it */
+	mkdir(dir, 0755);
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	if ((str = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1))
+			&& (f = fopen(tmp, "w"))) {
+		written = fputs(str, f) != EOF;
+		if (fclose(f) || !written || rename(tmp, path))
+			remove(tmp);
+	}
+	free(str);
+
+out:
+	xkb_context_unref(context);
+	return keymap;
+}
+
 void
 locksession(struct wl_listener *listener, void *data)
 {
@@ -1487,6 +2842,7 @@ locksession(struct wl_listener *listener, void *data)
 	lock->scene = wlr_scene_tree_create(layers[LyrBlock]);
 	cur_lock = lock->lock = session_lock;
 	locked = 1;
+	suspendscene(1);
 
 	LISTEN(&session_lock->events.new_surface, &lock->new_surface, createlocksurface);
 	LISTEN(&session_lock->events.destroy, &lock->destroy, destroysessionlock);
@@ -1495,10 +2851,52 @@ locksession(struct wl_listener *listener, void *data)
 	wlr_session_lock_v1_send_locked(session_lock);
 }
 
+void
+logrequest(void *data, enum wl_protocol_logger_type type,
+		const struct wl_protocol_logger_message *message)
+{
+	/* Called by libwayland right before dispatching each request, used
+	 * to account requests and commits per client in one second windows */
+	Peer *p;
+	uint64_t now, window;
+
+	if (type != WL_PROTOCOL_LOGGER_REQUEST
+			|| !(p = getpeer(wl_resource_get_client(message->resource))))
+		return;
+#ifdef XWAYLAND
+	/* Xwayland speaks for every X11 client, don't hold it back */
+	if (xwayland && xwayland->server && p->client == xwayland->server->client)
+		return;
+#endif
+
+	now = monotime();
+	if ((window = now / 1000000000) != p->window) {
+		p->window = window;
+		p->requests = p->commits = 0;
+		p->throttled = 0;
+	}
+	p->requests++;
+	p->total_requests++;
+	if (!strcmp(message->message->name, "commit")
+			&& !strcmp(wl_resource_get_class(message->resource), "wl_surface")) {
+		p->commits++;
+		p->total_commits++;
+	}
+
+	if (!p->throttled && ((client_request_budget && p->requests > client_request_budget)
+			|| (client_commit_budget && p->commits > client_commit_budget))) {
+		p->throttled = 1;
+		p->nthrottled++;
+		settimer(&throttle_timer,
+				1000 - (now / 1000000) % 1000);
+	}
+}
+
 void
 maplayersurfacenotify(struct wl_listener *listener, void *data)
 {
 	LayerSurface *l = wl_container_of(listener, l, map);
+	updateidleinhibitors(l->layer_surface->surface, 0);
 	motionnotify(0);
 }
 
@@ -1507,9 +2905,29 @@ mapnotify(struct wl_listener *listener, void *data)
 {
 	/* Called when the surface is mapped, or ready to display on-screen. */
 	Client *p, *w, *c = wl_container_of(listener, c, map);
+	Launch *l;
 	Monitor *m;
 	int i;
 
+	/* Measure how long it took since spawn() if we started this client */
+	c->maptime = monotime();
+	if (!c->spawntime && (l = launchfind(client_get_pid(c)))) {
+		/* Instances started by poolfill() wait hidden for usepool() */
+		if (l->pool && !client_is_unmanaged(c) && (!l->pool->id
+				|| strstr(client_get_appid(c) ? client_get_appid(c) : broken, l->pool->id)))
+			c->pool = l->pool;
+		else
+			launchrecord(c, l->time);
+		/* The client may still activate itself with the token, but those
+		 * of pool instances never expire */
+		if (l->pool) {
+			wlr_xdg_activation_token_v1_destroy(l->token);
+		} else {
+			l->token->data = NULL;
+			destroylaunch(&l->destroy, NULL);
+		}
+	}
+
 	/* Create scene tree for this client and its border */
 	c->scene = client_surface(c)->data = wlr_scene_tree_create(layers[LyrTile]);
 	wlr_scene_node_set_enabled(&c->scene->node, c->type != XDGShell);
@@ -1517,6 +2935,7 @@ mapnotify(struct wl_listener *listener, void *data)
 			? wlr_scene_xdg_surface_create(c->scene, c->surface.xdg)
 			: wlr_scene_subsurface_tree_create(c->scene, client_surface(c));
 	c->scene->node.data = c->scene_surface->node.data = c;
+	updateidleinhibitors(client_surface(c), 0);
 
 	/* Handle unmanaged clients first so we can return prior create borders */
 	if (client_is_unmanaged(c)) {
@@ -1566,6 +2985,8 @@ unset_fullscreen:
 	wl_list_for_each(w, &clients, link)
 		if (w != c && w->isfullscreen && m == w->mon && (w->tags & c->tags))
 			setfullscreen(w, 0);
+	flight(FlightMap, c->geom.width, c->geom.height, client_get_appid(c));
+	histadd(&map_time, (monotime() - c->maptime) / 1000);
 }
 
 void
@@ -1585,6 +3006,110 @@ maximizenotify(struct wl_listener *listener, void *data)
 		wlr_xdg_surface_schedule_configure(c->surface.xdg);
 }
 
+int
+metricsaccept(int fd, uint32_t mask, void *data)
+{
+	Scraper *s;
+	int sfd;
+
+	while ((sfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) >= 0) {
+		/* A few at a time is plenty, and stuck ones can't pile up */
+		if (wl_list_length(&scrapers) >= 4) {
+			close(sfd);
+			continue;
+		}
+		if (wl_list_empty(&scrapers))
+			settimer(&metrics_timer, SCRAPE_TIMEOUT);
+		s = ecalloc(1, sizeof(*s));
+		s->fd = sfd;
+		s->since = monotime();
+		s->source = wl_event_loop_add_fd(wl_display_get_event_loop(dpy), sfd,
+				WL_EVENT_READABLE, metricsserve, s);
+		wl_list_insert(&scrapers, &s->link);
+	}
+	/* Out of file descriptors or memory, the connection stays queued and
+	 * would wake us up again at once */
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR
+			&& errno != ECONNABORTED) {
+		wlr_log(WLR_ERROR, "metrics: accept: %s", strerror(errno));
+		pausemetrics(1);
+		if (wl_list_empty(&scrapers))
+			settimer(&metrics_timer, 1000);
+	}
+	return 0;
+}
+
+int
+metricsserve(int fd, uint32_t mask, void *data)
+{
+	/* Answer an HTTP request with printmetrics(). The socket is non-blocking
+	 * and only read or written when ready, so a slow scraper costs nothing
+	 * but its buffer until metricstimeout() drops it. */
+	Scraper *s = data;
+	ssize_t n;
+	FILE *f;
+
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR))
+		goto done;
+
+	if (!s->response) {
+		if ((n = read(fd, s->request + s->len, sizeof(s->request) - 1 - s->len)) < 0
+				&& (errno == EAGAIN || errno == EINTR))
+			return 0;
+		if (n <= 0)
+			goto done;
+		s->len += n;
+		s->request[s->len] = '\0';
+		/* Wait for the end of the headers, the request has no body */
+		if (!strstr(s->request, "\r\n\r\n") && !strstr(s->request, "\n\n")
+				&& s->len < sizeof(s->request) - 1)
+			return 0;
+
+		if (!(f = open_memstream(&s->response, &s->size)))
+			goto done;
+		if (strncmp(s->request, "GET ", 4)) {
+			fputs("HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n", f);
+		} else {
+			fputs("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+					"Connection: close\r\n\r\n", f);
+			printmetrics(f);
+		}
+		if (fclose(f) || !s->response)
+			goto done;
+		s->len = 0;
+		wl_event_source_fd_update(s->source, WL_EVENT_WRITABLE);
+	}
+
+	if ((n = send(fd, s->response + s->len, s->size - s->len, MSG_NOSIGNAL)) < 0
+			&& (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (n >= 0 && (s->len += n) < s->size)
+		return 0;
+done:
+	closescraper(s);
+	return 0;
+}
+
+int
+metricstimeout(void *data)
+{
+	/* Drop scrapers not done after SCRAPE_TIMEOUT ms */
+	Scraper *s, *tmp;
+	uint64_t now = monotime(), oldest = now;
+	if (metrics_paused)
+		pausemetrics(0);
+	wl_list_for_each_safe(s, tmp, &scrapers, link) {
+		if (now - s->since >= SCRAPE_TIMEOUT * 1000000ull)
+			closescraper(s);
+		else
+			oldest = MIN(oldest, s->since);
+	}
+	if (!wl_list_empty(&scrapers))
+		settimer(&metrics_timer,
+				(oldest + SCRAPE_TIMEOUT * 1000000ull - now) / 1000000 + 1);
+	return 0;
+}
+
 void
 monocle(Monitor *m)
 {
@@ -1594,7 +3119,9 @@ monocle(Monitor *m)
 	wl_list_for_each(c, &clients, link) {
 		if (!VISIBLEON(c, m) || c->isfloating || c->isfullscreen)
 			continue;
-		resize(c, m->w, 0);
+		/* Occluded clients are resized once they come on top */
+		if (!c->isoccluded)
+			resize(c, m->w, 0);
 		n++;
 	}
 	if (n)
@@ -1603,6 +3130,16 @@ monocle(Monitor *m)
 		wlr_scene_node_raise_to_top(&c->scene->node);
 }
 
+uint64_t
+monotime(void)
+{
+	struct timespec now;
+	if (virtual_now)
+		return virtual_now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
 void
 motionabsolute(struct wl_listener *listener, void *data)
 {
@@ -1613,8 +3150,11 @@ motionabsolute(struct wl_listener *listener, void *data)
 	 * so we have to warp the mouse there. There is also some hardware which
 	 * emits these events. */
 	struct wlr_pointer_motion_absolute_event *event = data;
+	uint64_t cpu = cputime();
+	noteinput(InputMotionAbsolute, 0, 0, event->x, event->y, 0, 0);
 	wlr_cursor_warp_absolute(cursor, &event->pointer->base, event->x, event->y);
 	motionnotify(event->time_msec);
+	account(HandlerMotion, cpu, FOCUSED(seat->pointer_state));
 }
 
 void
@@ -1678,6 +3218,9 @@ motionrelative(struct wl_listener *listener, void *data)
 	/* This event is forwarded by the cursor when a pointer emits a _relative_
 	 * pointer motion event (i.e. a delta) */
 	struct wlr_pointer_motion_event *event = data;
+	uint64_t cpu = cputime();
+	noteinput(InputMotion, 0, 0, event->delta_x, event->delta_y,
+			event->unaccel_dx, event->unaccel_dy);
 	/* The cursor doesn't move unless we tell it to. The cursor automatically
 	 * handles constraining the motion to the output layout, as well as any
 	 * special configuration applied for the specific input device which
@@ -1685,6 +3228,7 @@ motionrelative(struct wl_listener *listener, void *data)
 	 * the cursor around without any input. */
 	wlr_cursor_move(cursor, &event->pointer->base, event->delta_x, event->delta_y);
 	motionnotify(event->time_msec);
+	account(HandlerMotion, cpu, FOCUSED(seat->pointer_state));
 }
 
 void
@@ -1715,6 +3259,58 @@ moveresize(const Arg *arg)
 	}
 }
 
+void
+noteinput(unsigned int type, uint32_t code, uint32_t state, double x, double y,
+		double ux, double uy)
+{
+	uint64_t now = monotime();
+	InputEvent ev = {.type = type, .state = state, .code = code, .x = x, .y = y,
+			.ux = ux, .uy = uy};
+
+	/* The latency of an event lasts until the next frame, see rendermon() */
+	if (!input_pending[type])
+		input_pending[type] = now;
+	input_events[type]++;
+
+	/* The flight recorder gets keys and buttons, without keycodes since it
+	 * could hold a password, and a count of pointer events in between */
+	if (type == InputKey || type == InputButton) {
+		flight(type == InputKey ? FlightKey : FlightButton, state,
+				flight_pointer, NULL);
+		flight_pointer = 0;
+	} else {
+		flight_pointer++;
+	}
+
+	if (!record_file)
+		return;
+	ev.time = now - record_start;
+	if (fwrite(&ev, sizeof(ev), 1, record_file) != 1) {
+		wlr_log(WLR_ERROR, "recording input failed, stopping: %s", strerror(errno));
+		fclose(record_file);
+		record_file = NULL;
+	}
+}
+
+int
+occlusiontimeout(void *data)
+{
+	/* Arrange the outputs whose occluder changed opacity since the last
+	 * time, see commitnotify() */
+	Monitor *m;
+	occlusion_armed = 0;
+	wl_list_for_each(m, &mons, link) {
+		if (!m->occlusionchanged)
+			continue;
+		m->occlusionchanged = 0;
+		arrange(m);
+		occlusion_armed = 1;
+	}
+	if (occlusion_armed)
+		settimer(&occlusion_timer, MAX(occlusion_interval, 1));
+	return 0;
+}
+
 void
 outputmgrapply(struct wl_listener *listener, void *data)
 {
@@ -1784,12 +3380,68 @@ outputmgrtest(struct wl_listener *listener, void *data)
 	struct wlr_output_configuration_v1 *config = data;
 	outputmgrapplyortest(config, 1);
 }
+void
+pausemetrics(int pause)
+{
+	/* Stop accepting scrapers after accept() failed, until one of them is
+	 * closed or metricstimeout() tries again */
+	metrics_paused = pause;
+	wl_event_source_fd_update(metrics_source, pause ? 0 : WL_EVENT_READABLE);
+}
+
+
+int
+pingclients(void *data)
+{
+	Client *c;
+	int changed = 0;
+
+	/* An answer arrived if the last ping is done without timing out */
+	wl_list_for_each(c, &clients, link) {
+		if (!c->isunresponsive || c->pingtimedout || client_is_pinging(c))
+			continue;
+		c->isunresponsive = 0;
+		client_set_border_color(c, c->isurgent ? urgentcolor
+				: c == focustop(selmon) ? focuscolor : bordercolor);
+		changed = 1;
+	}
+
+	/* Unresponsive clients are pinged even if hidden, to notice them coming back */
+	wl_list_for_each(c, &clients, link) {
+		if ((!VISIBLEON(c, c->mon) && !c->isunresponsive) || c->frozen
+				|| client_is_pinging(c))
+			continue;
+		c->pingtimedout = 0;
+		client_ping(c);
+	}
+
+	if (changed)
+		printstatus();
+	settimer(&ping_timer, ping_interval);
+	return 0;
+}
+
+void
+pingtimeout(struct wl_listener *listener, void *data)
+{
+	/* The client didn't answer within ping_timeout, stop waiting for it
+	 * to ack configures before rendering */
+	Client *c = wl_container_of(listener, c, ping_timeout);
+	c->pingtimedout = 1;
+	if (c->isunresponsive)
+		return;
+	c->isunresponsive = 1;
+	if (!c->mon) /* not mapped */
+		return;
+	client_set_border_color(c, unresponsivecolor);
+	wlr_output_schedule_frame(c->mon->wlr_output);
+	printstatus();
+}
 
 void
 pointerfocus(Client *c, struct wlr_surface *surface, double sx, double sy,
 		uint32_t time)
 {
-	struct timespec now;
 	int internal_call = !time;
 
 	if (sloppyfocus && !internal_call && c && !client_is_unmanaged(c))
@@ -1801,10 +3453,8 @@ pointerfocus(Client *c, struct wlr_surface *surface, double sx, double sy,
 		return;
 	}
 
-	if (internal_call) {
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		time = now.tv_sec * 1000 + now.tv_nsec / 1000000;
-	}
+	if (internal_call)
+		time = monotime() / 1000000;
 
 	/* Let the client know that the mouse cursor has entered one
 	 * of its surfaces, and make keyboard focus follow if desired.
@@ -1814,6 +3464,161 @@ pointerfocus(Client *c, struct wlr_surface *surface, double sx, double sy,
 
 }
 
+void
+poolfill(void)
+{
+	/* Start instances of pools[] until each has count waiting or starting */
+	const Pool *p;
+	Client *c;
+	Launch *l, *tmp;
+	int n;
+
+	/* Their tokens do not expire, so forget instances that exited before
+	 * mapping here, the token destroy listener frees the Launch */
+	wl_list_for_each_safe(l, tmp, &launches, link)
+		if (l->pool && kill(l->pid, 0) && errno == ESRCH)
+			wlr_xdg_activation_token_v1_destroy(l->token);
+
+	for (p = pools; p < END(pools); p++) {
+		n = 0;
+		wl_list_for_each(c, &clients, link)
+			n += c->pool == p;
+		wl_list_for_each(l, &launches, link)
+			n += l->pool == p;
+		for (; n < p->count; n++)
+			spawncmd(p->cmd, p);
+	}
+}
+
+void
+printhist(const char *name, Histogram *h)
+{
+	/* Percentiles are the upper bound of the bucket they fall into */
+	static const int percentiles[] = {50, 90, 99};
+	uint64_t n = 0;
+	size_t i, p = 0;
+	fprintf(stderr, "%s count %llu sum_us %llu", name,
+			(unsigned long long)h->count, (unsigned long long)h->sum);
+	for (i = 0; i < LENGTH(h->bucket) && p < LENGTH(percentiles) && h->count; i++)
+		for (n += h->bucket[i]; p < LENGTH(percentiles)
+				&& n * 100 >= h->count * percentiles[p]; p++)
+			fprintf(stderr, " p%d %llu", percentiles[p], 1ull << i);
+	fputs(" hist", stderr);
+	for (i = 0; i < LENGTH(h->bucket); i++)
+		if (h->bucket[i])
+			fprintf(stderr, " %llu:%llu", 1ull << i, (unsigned long long)h->bucket[i]);
+	fputc('\n', stderr);
+}
+
+void
+printmetrichist(FILE *f, const char *name, const char *labels, Histogram *h)
+{
+	/* Prometheus buckets are cumulative; the last of ours holds everything
+	 * above it, which only +Inf can. Bucket i holds whole microseconds
+	 * under 2^i, so its le is 2^i - 1 of them. */
+	uint64_t n = 0;
+	size_t i;
+	for (i = 0; i < LENGTH(h->bucket) - 1; i++) {
+		n += h->bucket[i];
+		fprintf(f, "dwl_%s_seconds_bucket{%s%sle=\"%g\"} %llu\n", name, labels,
+				*labels ? "," : "", ((1ull << i) - 1) / 1e6, (unsigned long long)n);
+	}
+	fprintf(f, "dwl_%s_seconds_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels,
+			*labels ? "," : "", (unsigned long long)h->count);
+	fprintf(f, "dwl_%s_seconds_sum%s%s%s %.6f\n", name, *labels ? "{" : "", labels,
+			*labels ? "}" : "", h->sum / 1e6);
+	fprintf(f, "dwl_%s_seconds_count%s%s%s %llu\n", name, *labels ? "{" : "", labels,
+			*labels ? "}" : "", (unsigned long long)h->count);
+}
+
+void
+printmetrics(FILE *f)
+{
+	/* The same statistics as dumpstats(), and more, in Prometheus text
+	 * format for metricsserve() */
+	static const char *hist_names[] = {"frame", "arrange", "arrangelayers", "map",
+		"unmap", "destroy"};
+	Histogram *hists[] = {&frame_time, &arrange_time, &arrangelayers_time, &map_time,
+		&unmap_time, &destroy_time};
+	char labels[64];
+	Monitor *m;
+	Client *c;
+	size_t i;
+	int n;
+
+	fputs("# TYPE dwl_frames_rendered_total counter\n", f);
+	wl_list_for_each(m, &mons, link)
+		fprintf(f, "dwl_frames_rendered_total{output=\"%s\"} %llu\n",
+				m->wlr_output->name, (unsigned long long)m->rendered);
+	fputs("# TYPE dwl_frames_skipped_total counter\n", f);
+	wl_list_for_each(m, &mons, link)
+		fprintf(f, "dwl_frames_skipped_total{output=\"%s\"} %llu\n",
+				m->wlr_output->name, (unsigned long long)m->skipped);
+	fputs("# TYPE dwl_output_cpu_seconds_total counter\n", f);
+	wl_list_for_each(m, &mons, link)
+		fprintf(f, "dwl_output_cpu_seconds_total{output=\"%s\"} %.6f\n",
+				m->wlr_output->name, m->cpu / 1e9);
+
+	fputs("# TYPE dwl_clients gauge\n", f);
+	wl_list_for_each(m, &mons, link) {
+		for (i = 0; i < TAGCOUNT; i++) {
+			n = 0;
+			wl_list_for_each(c, &clients, link)
+				n += c->mon == m && (c->tags & 1u << i);
+			fprintf(f, "dwl_clients{output=\"%s\",tag=\"%zu\"} %d\n",
+					m->wlr_output->name, i + 1, n);
+		}
+	}
+	n = 0;
+	wl_list_for_each(c, &clients, link)
+		n += !!c->resize;
+	fprintf(f, "# TYPE dwl_resizes_pending gauge\ndwl_resizes_pending %d\n", n);
+
+	fputs("# TYPE dwl_input_events_total counter\n", f);
+	for (i = 0; i < LENGTH(input_events); i++)
+		fprintf(f, "dwl_input_events_total{type=\"%s\"} %llu\n", input_names[i],
+				(unsigned long long)input_events[i]);
+	fputs("# TYPE dwl_input_latency_seconds histogram\n", f);
+	for (i = 0; i < LENGTH(input_latency); i++) {
+		snprintf(labels, sizeof(labels), "type=\"%s\"", input_names[i]);
+		printmetrichist(f, "input_latency", labels, &input_latency[i]);
+	}
+	fputs("# TYPE dwl_input_cpu_seconds histogram\n", f);
+	for (i = 0; i < LENGTH(input_cpu); i++) {
+		snprintf(labels, sizeof(labels), "type=\"%s\"", input_names[i]);
+		printmetrichist(f, "input_cpu", labels, &input_cpu[i]);
+	}
+
+	for (i = 0; i < LENGTH(hists); i++) {
+		fprintf(f, "# TYPE dwl_%s_seconds histogram\n", hist_names[i]);
+		printmetrichist(f, hist_names[i], "", hists[i]);
+	}
+	fputs("# TYPE dwl_handler_calls_total counter\n", f);
+	for (i = 0; i < LENGTH(handler_names); i++)
+		fprintf(f, "dwl_handler_calls_total{handler=\"%s\"} %llu\n", handler_names[i],
+				(unsigned long long)handler_calls[i]);
+	fputs("# TYPE dwl_handler_cpu_seconds_total counter\n", f);
+	for (i = 0; i < LENGTH(handler_names); i++)
+		fprintf(f, "dwl_handler_cpu_seconds_total{handler=\"%s\"} %.6f\n",
+				handler_names[i], handler_cpu[i] / 1e9);
+
+	fprintf(f, "# TYPE dwl_status_held_total counter\ndwl_status_held_total %llu\n",
+			(unsigned long long)status_held);
+	fprintf(f, "# TYPE dwl_status_errors_total counter\ndwl_status_errors_total %llu\n",
+			(unsigned long long)status_errors);
+	fprintf(f, "# TYPE dwl_tokens_expired_total counter\ndwl_tokens_expired_total %u\n",
+			tokens_expired);
+#ifdef XWAYLAND
+	fprintf(f, "# TYPE dwl_xwayland_running gauge\ndwl_xwayland_running %d\n",
+			xwayland && xwayland->server && xwayland->server->pid > 0);
+	fprintf(f, "# TYPE dwl_xwayland_clients gauge\ndwl_xwayland_clients %u\n", nxclients);
+	fprintf(f, "# TYPE dwl_xwayland_stops_total counter\ndwl_xwayland_stops_total %u\n",
+			xwayland_stops);
+	fprintf(f, "# TYPE dwl_xwayland_kills_total counter\ndwl_xwayland_kills_total %u\n",
+			xwayland_kills);
+#endif
+}
+
 void
 printstatus(void)
 {
@@ -1827,9 +3632,9 @@ printstatus(void)
 		wl_list_for_each(c, &clients, link) {
 			if (c->mon != m)
 				continue;
-			occ |= c->tags;
+			occ |= c->tags & TAGMASK;
 			if (c->isurgent)
-				urg |= c->tags;
+				urg |= c->tags & TAGMASK;
 		}
 		if ((c = focustop(m))) {
 			title = client_get_title(c);
@@ -1838,12 +3643,16 @@ printstatus(void)
 			printf("%s appid %s\n", m->wlr_output->name, appid ? appid : broken);
 			printf("%s fullscreen %u\n", m->wlr_output->name, c->isfullscreen);
 			printf("%s floating %u\n", m->wlr_output->name, c->isfloating);
+			if (ping_interval)
+				printf("%s unresponsive %u\n", m->wlr_output->name, c->isunresponsive);
 			sel = c->tags;
 		} else {
 			printf("%s title \n", m->wlr_output->name);
 			printf("%s appid \n", m->wlr_output->name);
 			printf("%s fullscreen \n", m->wlr_output->name);
 			printf("%s floating \n", m->wlr_output->name);
+			if (ping_interval)
+				printf("%s unresponsive \n", m->wlr_output->name);
 			sel = 0;
 		}
 
@@ -1852,15 +3661,77 @@ printstatus(void)
 				sel, urg);
 		printf("%s layout %s\n", m->wlr_output->name, m->ltsymbol);
 	}
-	fflush(stdout);
+	if (fflush(stdout) || ferror(stdout)) {
+		status_errors++;
+		clearerr(stdout);
+	}
+}
+
+unsigned long long
+procstart(pid_t pid)
+{
+	/* Start time of pid since boot, telling it apart from a later process
+	 * with the same pid, 0 if it's gone */
+	char buf[1024], *p;
+	unsigned long long start = 0;
+	ssize_t len;
+	int fd, i;
+
+	snprintf(buf, sizeof(buf), "/proc/%d/stat", (int)pid);
+	if ((fd = open(buf, O_RDONLY | O_CLOEXEC)) < 0)
+		return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+	/* The command name can hold anything but ends with the last ')', the
+	 * start time is the 20th field after it */
+	if (!(p = strrchr(buf, ')')))
+		return 0;
+	for (i = 0; i < 20 && p; i++)
+		p = strchr(p + 1, ' ');
+	if (p)
+		start = strtoull(p + 1, NULL, 10);
+	return start;
 }
 
 void
 quit(const Arg *arg)
 {
+	running = 0;
 	wl_display_terminate(dpy);
 }
 
+int
+readclock(int fd, uint32_t mask, void *data)
+{
+	/* Each line of clock_fd advances the virtual clock by that many
+	 * milliseconds, see stepclock() */
+	static char buf[64];
+	static size_t len;
+	char *p, *nl;
+	ssize_t n;
+
+	if ((n = read(fd, buf + len, sizeof(buf) - 1 - len)) <= 0) {
+		if (n < 0 && errno == EINTR)
+			return 0;
+		wl_event_source_remove(clock_source);
+		clock_eof = 1;
+		return 0;
+	}
+	len += n;
+	buf[len] = '\0';
+	for (p = buf; (nl = strchr(p, '\n')); p = nl + 1)
+		clock_target += strtoull(p, NULL, 10) * 1000000;
+	len -= p - buf;
+	memmove(buf, p, len);
+	/* Drop lines too long to be a number */
+	if (len == sizeof(buf) - 1)
+		len = 0;
+	return 0;
+}
+
 void
 rendermon(struct wl_listener *listener, void *data)
 {
@@ -1870,13 +3741,31 @@ rendermon(struct wl_listener *listener, void *data)
 	Client *c;
 	struct wlr_output_state pending = {0};
 	struct wlr_gamma_control_v1 *gamma_control;
-	struct timespec now;
+	uint64_t start = monotime();
+	uint32_t commit_seq = m->wlr_output->commit_seq;
+	uint64_t cpu = cputime();
+	size_t i;
+
+	/* With a virtual clock, frames only come from stepclock() */
+	if (virtual_now && !m->virtual_frame)
+		return;
+	m->virtual_frame = 0;
+
+#ifdef XWAYLAND
+	/* Answer the configure requests of tiled X11 clients, see configurex11() */
+	wl_list_for_each(c, &clients, link)
+		if (c->configurepending && c->mon == m)
+			ackconfigurex11(c);
+#endif
 
 	/* Render if no XDG clients have an outstanding resize and are visible on
-	 * this monitor. */
+	 * this monitor. Unresponsive clients keep showing their last buffer. */
 	wl_list_for_each(c, &clients, link)
-		if (c->resize && !c->isfloating && client_is_rendered_on_mon(c, m) && !client_is_stopped(c))
+		if (c->resize && !c->isfloating && !c->isunresponsive
+				&& client_is_rendered_on_mon(c, m) && !client_is_stopped(c)) {
+			m->skipped++;
 			goto skip;
+		}
 
 	/*
 	 * HACK: The "correct" way to set the gamma is to commit it together with
@@ -1903,12 +3792,92 @@ rendermon(struct wl_listener *listener, void *data)
 commit:
 		wlr_scene_output_commit(m->scene_output, NULL);
 	}
-
-skip:
-	/* Let clients know a frame has been rendered */
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	wlr_scene_output_send_frame_done(m->scene_output, &now);
-	wlr_output_state_finish(&pending);
+
+skip:
+	/* Let clients know a frame has been rendered */
+	wlr_scene_output_for_each_buffer(m->scene_output, sendframedone, m);
+	wlr_output_state_finish(&pending);
+
+	/* Input is answered by the first frame actually shown after it */
+	if (m->wlr_output->commit_seq != commit_seq) {
+		m->rendered++;
+		for (i = 0; i < LENGTH(input_pending); i++) {
+			if (input_pending[i])
+				histadd(&input_latency[i], (monotime() - input_pending[i]) / 1000);
+			input_pending[i] = 0;
+		}
+	}
+	histadd(&frame_time, (monotime() - start) / 1000);
+	m->cpu += account(HandlerRender, cpu, NULL);
+}
+
+int
+replayinput(void *data)
+{
+	/* Events are injected through virtual devices, so they take the same
+	 * path through wlroots and dwl as real ones. Their timestamps come
+	 * from the recording to keep runs comparable. */
+	uint64_t now = monotime() - replay_start;
+	InputEvent *ev = &replay_next;
+	uint32_t time;
+	struct timespec before, after;
+
+	while (replay_fast || ev->time <= now) {
+		time = ev->time / 1000000;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
+		switch (ev->type) {
+		case InputKey:
+			wlr_keyboard_notify_key(&replay_keyboard, &(struct wlr_keyboard_key_event){
+					.time_msec = time, .keycode = ev->code,
+					.update_state = true, .state = ev->state});
+			break;
+		case InputMotion:
+			wl_signal_emit_mutable(&replay_pointer.events.motion,
+					&(struct wlr_pointer_motion_event){
+					.pointer = &replay_pointer, .time_msec = time,
+					.delta_x = ev->x, .delta_y = ev->y,
+					.unaccel_dx = ev->ux, .unaccel_dy = ev->uy});
+			break;
+		case InputMotionAbsolute:
+			wl_signal_emit_mutable(&replay_pointer.events.motion_absolute,
+					&(struct wlr_pointer_motion_absolute_event){
+					.pointer = &replay_pointer, .time_msec = time,
+					.x = ev->x, .y = ev->y});
+			break;
+		case InputButton:
+			wl_signal_emit_mutable(&replay_pointer.events.button,
+					&(struct wlr_pointer_button_event){
+					.pointer = &replay_pointer, .time_msec = time,
+					.button = ev->code, .state = ev->state});
+			break;
+		case InputAxis:
+			wl_signal_emit_mutable(&replay_pointer.events.axis,
+					&(struct wlr_pointer_axis_event){
+					.pointer = &replay_pointer, .time_msec = time,
+					.source = ev->state, .orientation = ev->code,
+					.delta = ev->x, .delta_discrete = ev->y});
+			break;
+		}
+		if (ev->type != InputKey && ev->type < InputLast)
+			wl_signal_emit_mutable(&replay_pointer.events.frame, &replay_pointer);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
+		if (ev->type < InputLast)
+			histadd(&input_cpu[ev->type], (after.tv_sec - before.tv_sec) * 1000000
+					+ (after.tv_nsec - before.tv_nsec) / 1000);
+
+		if (fread(ev, sizeof(*ev), 1, replay_file) != 1) {
+			wlr_log(WLR_INFO, "input replay finished");
+			fclose(replay_file);
+			replay_file = NULL;
+			return 0;
+		}
+		/* Leave the event loop one turn to render between events */
+		if (replay_fast)
+			break;
+	}
+	settimer(&replay_timer,
+			replay_fast ? 1 : (ev->time - now) / 1000000 + 1);
+	return 0;
 }
 
 void
@@ -1931,6 +3900,32 @@ requestmonstate(struct wl_listener *listener, void *data)
 	updatemons(NULL, NULL);
 }
 
+int
+resetstats(int signo, void *data)
+{
+	/* Start measuring a new run, e.g. between benchmark scenarios */
+	Monitor *m;
+	Peer *p;
+	memset(&arrange_time, 0, sizeof(arrange_time));
+	memset(&arrangelayers_time, 0, sizeof(arrangelayers_time));
+	memset(&frame_time, 0, sizeof(frame_time));
+	memset(&map_time, 0, sizeof(map_time));
+	memset(&unmap_time, 0, sizeof(unmap_time));
+	memset(&destroy_time, 0, sizeof(destroy_time));
+	memset(input_latency, 0, sizeof(input_latency));
+	memset(input_cpu, 0, sizeof(input_cpu));
+	memset(handler_calls, 0, sizeof(handler_calls));
+	memset(handler_cpu, 0, sizeof(handler_cpu));
+	memset(&repeat_lateness, 0, sizeof(repeat_lateness));
+	repeat_skipped = 0;
+	wl_list_for_each(m, &mons, link)
+		m->cpu = m->rendered = m->skipped = 0;
+	wl_list_for_each(p, &peers, link)
+		p->cpu = p->frames = p->total_requests = p->total_commits = p->nthrottled = 0;
+	getrusage(RUSAGE_SELF, &stats_rusage);
+	return 0;
+}
+
 void
 resize(Client *c, struct wlr_box geo, int interact)
 {
@@ -1954,6 +3949,8 @@ resize(Client *c, struct wlr_box geo, int interact)
 	/* this is a no-op if size hasn't changed */
 	c->resize = client_set_size(c, c->geom.width - 2 * c->bw,
 			c->geom.height - 2 * c->bw);
+	if (c->resize)
+		flight(FlightConfigure, c->resize, c->geom.width, client_get_appid(c));
 	client_get_clip(c, &clip);
 	wlr_scene_subsurface_tree_set_clip(&c->scene_surface->node, &clip);
 }
@@ -1966,30 +3963,41 @@ run(char *startup_cmd)
 	if (!socket)
 		die("startup: display_add_socket_auto");
 	setenv("WAYLAND_DISPLAY", socket, 1);
+	if (metrics_socket)
+		listenmetrics(socket);
 
 	/* Start the backend. This will enumerate outputs and inputs, become the DRM
 	 * master, etc */
 	if (!wlr_backend_start(backend))
 		die("startup: backend_start");
 
+	/* Recording and replay both start with the startup command, so a replay
+	 * run with the same command sees the same clients at the same time */
+	record_start = replay_start = monotime();
+	if (replay_file) {
+		if (fread(&replay_next, sizeof(replay_next), 1, replay_file) != 1)
+			die("startup: input replay is empty");
+		wlr_keyboard_init(&replay_keyboard, &replay_keyboard_impl, "dwl-replay");
+		inputdevice(NULL, &replay_keyboard.base);
+		wlr_pointer_init(&replay_pointer, &replay_pointer_impl, "dwl-replay");
+		inputdevice(NULL, &replay_pointer.base);
+		addtimer(&replay_timer, replayinput, NULL);
+		settimer(&replay_timer, 1);
+	}
+
 	/* Now that the socket exists and the backend is started, run the startup command */
 	if (startup_cmd) {
 		int piperw[2];
+		char *argv[] = { "/bin/sh", "-c", startup_cmd, NULL };
 		if (pipe(piperw) < 0)
 			die("startup: pipe:");
-		if ((child_pid = fork()) < 0)
-			die("startup: fork:");
-		if (child_pid == 0) {
-			dup2(piperw[0], STDIN_FILENO);
-			close(piperw[0]);
-			close(piperw[1]);
-			execl("/bin/sh", "/bin/sh", "-c", startup_cmd, NULL);
-			die("startup: execl:");
-		}
+		if ((child_pid = launch(argv, NULL, piperw[0], -1, 0)) < 0)
+			die("startup: failed to launch startup command");
 		dup2(piperw[1], STDOUT_FILENO);
 		close(piperw[1]);
 		close(piperw[0]);
 	}
+	poolfill();
 	printstatus();
 
 	/* At this point the outputs are initialized, choose initial selmon based on
@@ -2007,7 +4015,85 @@ run(char *startup_cmd)
 	 * compositor. Starting the backend rigged up all of the necessary event
 	 * loop configuration to listen to libinput events, DRM events, generate
 	 * frame events at the refresh rate, and so on. */
-	wl_display_run(dpy);
+	if (!input_dpy && !virtual_now) {
+		wl_display_run(dpy);
+		return;
+	}
+	if (virtual_now)
+		clock_source = wl_event_loop_add_fd(wl_display_get_event_loop(dpy),
+				clock_fd, WL_EVENT_READABLE, readclock, NULL);
+
+	/* Same as wl_display_run(), except that pending input is handled
+	 * before every batch of events from the main loop, so clients flooding
+	 * us with requests can delay input by at most one epoll batch. The
+	 * input loop is also nested in the main one to wake us up. */
+	if (input_dpy)
+		wl_event_loop_add_fd(wl_display_get_event_loop(dpy),
+				wl_event_loop_get_fd(wl_display_get_event_loop(input_dpy)),
+				WL_EVENT_READABLE, dispatchinput, NULL);
+	while (running) {
+		if (input_dpy)
+			dispatchinput(-1, 0, NULL);
+		wl_display_flush_clients(dpy);
+		wl_event_loop_dispatch(wl_display_get_event_loop(dpy),
+				virtual_now ? settleclock() : -1);
+	}
+}
+
+void
+sendframedone(struct wlr_scene_buffer *buffer, int sx, int sy, void *data)
+{
+	/* Same as wlr_scene_output_send_frame_done(), but clients over their
+	 * budget don't get frame callbacks until unthrottle() */
+	Monitor *m = data;
+	struct wlr_scene_surface *scene_surface;
+	struct wl_client *client = NULL;
+	struct timespec now;
+	uint64_t ns;
+	Peer *p;
+
+	if (buffer->primary_output != m->scene_output)
+		return;
+	if ((scene_surface = wlr_scene_surface_try_from_buffer(buffer))
+			&& isthrottled(client = wl_resource_get_client(scene_surface->surface->resource)))
+		return;
+	ns = monotime();
+	now.tv_sec = ns / 1000000000;
+	now.tv_nsec = ns % 1000000000;
+	wlr_scene_buffer_send_frame_done(buffer, &now);
+	if ((p = getpeer(client)))
+		p->frames++;
+}
+
+struct wl_client *
+serialclient(uint32_t serial)
+{
+	/* Event serials are unique, find the client that was sent this one.
+	 * Xwayland's selections use new serials, so they belong to no one. */
+	struct wlr_seat_client *sc;
+	wl_list_for_each(sc, &seat->clients, link)
+		if (wlr_seat_client_validate_event_serial(sc, serial))
+			return sc->client;
+	return NULL;
+}
+
+void
+setcloexec(void)
+{
+	/* Mark every fd we own as close-on-exec; fds opened by wlroots and
+	 * libwayland mostly are already, but drivers and libraries may not be. */
+	DIR *dir;
+	struct dirent *ent;
+	int fd;
+
+	if (!(dir = opendir("/proc/self/fd")))
+		return;
+	while ((ent = readdir(dir))) {
+		fd = atoi(ent->d_name);
+		if (fd > STDERR_FILENO && fd != dirfd(dir))
+			fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+	}
+	closedir(dir);
 }
 
 void
@@ -2018,8 +4104,17 @@ setcursor(struct wl_listener *listener, void *data)
 	/* If we're "grabbing" the cursor, don't use the client's image, we will
 	 * restore it after "grabbing" sending a leave event, followed by a enter
 	 * event, which will result in the client requesting set the cursor surface */
+	Peer *p = getpeer(event->seat_client->client);
 	if (cursor_mode != CurNormal && cursor_mode != CurPressed)
 		return;
+	if (p && p->throttled) {
+		hold(&p->cursor, event->surface,
+				event->surface ? &event->surface->events.destroy : NULL);
+		p->cursor_shape = NULL;
+		p->hotspot_x = event->hotspot_x;
+		p->hotspot_y = event->hotspot_y;
+		return;
+	}
 	/* This can be sent by any client, so we check to make sure this one is
 	 * actually has pointer focus first. If so, we can tell the cursor to
 	 * use the provided surface as the cursor image. It will set the
@@ -2034,8 +4129,14 @@ void
 setcursorshape(struct wl_listener *listener, void *data)
 {
 	struct wlr_cursor_shape_manager_v1_request_set_shape_event *event = data;
+	Peer *p = getpeer(event->seat_client->client);
 	if (cursor_mode != CurNormal && cursor_mode != CurPressed)
 		return;
+	if (p && p->throttled) {
+		hold(&p->cursor, NULL, NULL);
+		p->cursor_shape = wlr_cursor_shape_v1_name(event->shape);
+		return;
+	}
 	/* This can be sent by any client, so we check to make sure this one is
 	 * actually has pointer focus first. If so, we can tell the cursor to
 	 * use the provided cursor shape. */
@@ -2137,6 +4238,11 @@ setmon(Client *c, Monitor *m, uint32_t newtags)
 		setfullscreen(c, c->isfullscreen); /* This will call arrange(c->mon) */
 		setfloating(c, c->isfloating);
 	}
+#ifdef XWAYLAND
+	/* The frame of oldmon it was waiting for doesn't concern it any more */
+	if (c->configurepending)
+		ackconfigurex11(c);
+#endif
 	focusclient(focustop(selmon), 1);
 }
 
@@ -2145,9 +4251,16 @@ setpsel(struct wl_listener *listener, void *data)
 {
 	/* This event is raised by the seat when a client wants to set the selection,
 	 * usually when the user copies something. wlroots allows compositors to
-	 * ignore such requests if they so choose, but in dwl we always honor
-	 */
+	 * ignore such requests if they so choose, dwl honors them, those of a
+	 * throttled client once unthrottle() runs */
 	struct wlr_seat_request_set_primary_selection_event *event = data;
+	Peer *p = getpeer(serialclient(event->serial));
+	if (p && p->throttled) {
+		hold(&p->primary_selection, event->source,
+				event->source ? &event->source->events.destroy : NULL);
+		p->primary_selection_serial = event->serial;
+		return;
+	}
 	wlr_seat_set_primary_selection(seat, event->source, event->serial);
 }
 
@@ -2156,27 +4269,101 @@ setsel(struct wl_listener *listener, void *data)
 {
 	/* This event is raised by the seat when a client wants to set the selection,
 	 * usually when the user copies something. wlroots allows compositors to
-	 * ignore such requests if they so choose, but in dwl we always honor
-	 */
+	 * ignore such requests if they so choose, dwl honors them, those of a
+	 * throttled client once unthrottle() runs */
 	struct wlr_seat_request_set_selection_event *event = data;
+	Peer *p = getpeer(serialclient(event->serial));
+	if (p && p->throttled) {
+		hold(&p->selection, event->source,
+				event->source ? &event->source->events.destroy : NULL);
+		p->selection_serial = event->serial;
+		return;
+	}
 	wlr_seat_set_selection(seat, event->source, event->serial);
 }
 
+void
+settimer(Timer *t, int ms)
+{
+	/* Same as wl_event_source_timer_update(), on the virtual clock if any */
+	if (virtual_now)
+		t->due = ms ? virtual_now + ms * 1000000ull : 0;
+	else
+		wl_event_source_timer_update(t->source, ms);
+}
+
+int
+settleclock(void)
+{
+	/* Step the virtual clock once everything due at the current time has
+	 * been handled, including the frames stepclock() asked for, and the
+	 * results were flushed to clients. Returns the timeout for the next
+	 * dispatch of the event loop. */
+	struct pollfd pfd = {wl_event_loop_get_fd(wl_display_get_event_loop(dpy)), POLLIN, 0};
+	Monitor *m;
+	int busy = 0, timeout = -1;
+
+	wl_list_for_each(m, &mons, link) {
+		if (!m->virtual_frame || !m->wlr_output->enabled)
+			continue;
+		busy = 1;
+		/* Then the frame is sent from an idle source, which does not
+		 * wake up the event loop */
+		if (!m->wlr_output->frame_pending)
+			timeout = 0;
+	}
+	if (busy || poll(&pfd, 1, 0) > 0)
+		return timeout;
+
+	if (clock_target > virtual_now)
+		stepclock();
+	else if (clock_eof)
+		running = 0;
+	else
+		return -1;
+	return 0;
+}
+
 void
 setup(void)
 {
+	struct wlr_backend *input_backend = NULL;
 	int i, sig[] = {SIGCHLD, SIGINT, SIGTERM, SIGPIPE};
+	int crashsig[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
 	struct sigaction sa = {.sa_flags = SA_RESTART, .sa_handler = handlesig};
+	struct sigaction sa_crash = {.sa_flags = SA_RESETHAND|SA_ONSTACK, .sa_handler = crash};
+	stack_t ss = {.ss_sp = crash_stack, .ss_size = sizeof(crash_stack)};
 	sigemptyset(&sa.sa_mask);
+	sigemptyset(&sa_crash.sa_mask);
 
 	for (i = 0; i < LENGTH(sig); i++)
 		sigaction(sig[i], &sa, NULL);
 
+	/* The flight recorder is written out on crashes and die(), see flight() */
+	snprintf(flight_path, sizeof(flight_path), "%s/dwl-flight.%d",
+			getenv("XDG_RUNTIME_DIR"), (int)getpid());
+	sigaltstack(&ss, NULL);
+	for (i = 0; i < LENGTH(crashsig); i++)
+		sigaction(crashsig[i], &sa_crash, NULL);
+	atexit(flightatexit);
+
 	wlr_log_init(log_level, NULL);
 
 	/* The Wayland display is managed by libwayland. It handles accepting
 	 * clients from the Unix socket, manging Wayland globals, and so on. */
 	dpy = wl_display_create();
+	wl_list_init(&timers);
+	wl_list_init(&scrapers);
+
+	/* Account requests of every client, see logrequest() */
+	wl_list_init(&peers);
+	wl_display_add_protocol_logger(dpy, logrequest, NULL);
+	wl_display_add_client_created_listener(dpy, &peer_created);
+	addtimer(&throttle_timer, unthrottle, NULL);
+
+	/* Statistics are written to stderr on SIGUSR1, and reset on SIGUSR2 */
+	wl_event_loop_add_signal(wl_display_get_event_loop(dpy), SIGUSR1, dumpstats, NULL);
+	wl_event_loop_add_signal(wl_display_get_event_loop(dpy), SIGUSR2, resetstats, NULL);
 
 	/* The backend is a wlroots feature which abstracts the underlying input and
 	 * output hardware. The autocreate option will choose the most suitable
@@ -2185,6 +4372,31 @@ setup(void)
 	if (!(backend = wlr_backend_autocreate(dpy, &session)))
 		die("couldn't create backend");
 
+	/* Headless outputs can be added and removed with SIGRTMIN and
+	 * SIGRTMIN+1, to test output hotplug, see hotplug() */
+	if (wlr_backend_is_multi(backend))
+		wlr_multi_for_each_backend(backend, findheadlessbackend, NULL);
+	else
+		findheadlessbackend(backend, NULL);
+	if (headless_backend) {
+		wl_event_loop_add_signal(wl_display_get_event_loop(dpy), SIGRTMIN, hotplug, NULL);
+		wl_event_loop_add_signal(wl_display_get_event_loop(dpy), SIGRTMIN + 1, hotplug, NULL);
+	}
+
+	/* Replace the libinput backend, if any, with one running on its own
+	 * event loop, so that run() can handle input ahead of clients. It has
+	 * not been started yet, so there are no devices to lose. */
+	if (input_priority && wlr_backend_is_multi(backend)) {
+		wlr_multi_for_each_backend(backend, findinputbackend, &input_backend);
+		if (input_backend) {
+			wlr_backend_destroy(input_backend);
+			input_dpy = wl_display_create();
+			if (!(input_backend = wlr_libinput_backend_create(input_dpy, session))
+					|| !wlr_multi_backend_add(backend, input_backend))
+				die("couldn't create libinput backend");
+		}
+	}
+
 	/* Initialize the scene graph used to lay out windows */
 	scene = wlr_scene_create();
 	for (i = 0; i < NUM_LAYERS; i++)
@@ -2262,9 +4474,18 @@ setup(void)
 	 */
 	wl_list_init(&clients);
 	wl_list_init(&fstack);
+	wl_list_init(&launches);
+	wl_list_init(&launchstats);
 
 	xdg_shell = wlr_xdg_shell_create(dpy, 6);
+	xdg_shell->ping_timeout = ping_timeout;
+	addtimer(&freeze_timer, freezeclients, NULL);
+	addtimer(&occlusion_timer, occlusiontimeout, NULL);
 	LISTEN_STATIC(&xdg_shell->events.new_surface, createnotify);
+	if (ping_interval) {
+		addtimer(&ping_timer, pingclients, NULL);
+		settimer(&ping_timer, ping_interval);
+	}
 
 	layer_shell = wlr_layer_shell_v1_create(dpy, 3);
 	LISTEN_STATIC(&layer_shell->events.new_surface, createlayersurface);
@@ -2272,6 +4493,7 @@ setup(void)
 	idle_notifier = wlr_idle_notifier_v1_create(dpy);
 
 	idle_inhibit_mgr = wlr_idle_inhibit_v1_create(dpy);
+	wl_list_init(&inhibitors);
 	LISTEN_STATIC(&idle_inhibit_mgr->events.new_inhibitor, createidleinhibitor);
 
 	session_lock_mgr = wlr_session_lock_manager_v1_create(dpy);
@@ -2353,6 +4575,11 @@ setup(void)
 	if (xwayland) {
 		LISTEN_STATIC(&xwayland->events.ready, xwaylandready);
 		LISTEN_STATIC(&xwayland->events.new_surface, createnotifyx11);
+		addtimer(&xwayland_timer, xwaylandidle, NULL);
+		addtimer(&xwayland_stop_timer, xwaylandstopped, NULL);
+		/* wlroots won't start again an Xwayland that quit within 5 seconds,
+		 * which would leave DISPLAY dead */
+		xwayland_idle = xwayland_timeout > 0 ? MAX(xwayland_timeout, 6) * 1000 : 0;
 
 		setenv("DISPLAY", xwayland->display_name, 1);
 	} else {
@@ -2361,15 +4588,100 @@ setup(void)
 #endif
 }
 
+void
+seturgent(struct wlr_surface *surface, struct wlr_xdg_activation_token_v1 *token)
+{
+	Launch *l;
+	Client *c = NULL;
+	toplevel_from_wlr_surface(surface, &c, NULL);
+	if (!c || c->pool)
+		return;
+
+	/* A client we spawned through a wrapper, found by its token */
+	if (token && (l = token->data) && !c->spawntime && c->maptime)
+		launchrecord(c, l->time);
+
+	if (c == focustop(selmon))
+		return;
+
+	if (client_surface(c)->mapped)
+		client_set_border_color(c, urgentcolor);
+	c->isurgent = 1;
+	printstatus();
+}
+
+int
+sharesprocess(Client *c, pid_t pid, const char *cgroup)
+{
+	/* Whether c belongs to process pid or, if not NULL, to cgroup */
+	char buf[PATH_MAX];
+	pid_t cpid = client_get_pid(c);
+	return cpid == pid || (cgroup && cpid > 0
+			&& !getcgroup(cpid, buf, sizeof(buf)) && !strcmp(buf, cgroup));
+}
+
 void
 spawn(const Arg *arg)
 {
-	if (fork() == 0) {
-		dup2(STDERR_FILENO, STDOUT_FILENO);
-		setsid();
-		execvp(((char **)arg->v)[0], (char **)arg->v);
-		die("dwl: execvp %s failed:", ((char **)arg->v)[0]);
+	spawncmd(arg->v, NULL);
+}
+
+Launch *
+spawncmd(const char *const *cmd, const Pool *pool)
+{
+	/* Give the child an activation token and our launch time, so that its
+	 * windows can be matched to this spawn() in mapnotify() and urgent() */
+	char tokenvar[128], startupvar[128], timevar[64], **envp, **e;
+	struct wlr_xdg_activation_token_v1 *token;
+	const char *name;
+	Launch *l = ecalloc(1, sizeof(*l));
+	uint32_t timeout = activation->token_timeout_msec;
+	size_t n = 0;
+
+	/* Pool instances are started in the background, often several at once,
+	 * and may well map after the usual timeout. Without a token they would
+	 * show up as ordinary windows. poolfill() drops them if they exit. */
+	if (pool)
+		activation->token_timeout_msec = 0;
+	token = wlr_xdg_activation_token_v1_create(activation);
+	activation->token_timeout_msec = timeout;
+	l->pool = pool;
+	name = wlr_xdg_activation_token_v1_get_name(token);
+	l->time = monotime();
+	snprintf(tokenvar, sizeof(tokenvar), "XDG_ACTIVATION_TOKEN=%s", name);
+	snprintf(startupvar, sizeof(startupvar), "DESKTOP_STARTUP_ID=%s", name);
+	snprintf(timevar, sizeof(timevar), "DWL_SPAWN_TIME=%llu", (unsigned long long)l->time);
+
+	for (e = environ; *e; e++)
+		n++;
+	envp = ecalloc(n + 4, sizeof(*envp));
+	n = 0;
+	envp[n++] = tokenvar;
+	envp[n++] = startupvar;
+	envp[n++] = timevar;
+	for (e = environ; *e; e++) {
+		/* Drop those dwl itself was started with: which duplicate wins
+		 * differs between getenv() and shells */
+		if (!strncmp(*e, "XDG_ACTIVATION_TOKEN=", 21)
+				|| !strncmp(*e, "DESKTOP_STARTUP_ID=", 19)
+				|| !strncmp(*e, "DWL_SPAWN_TIME=", 15))
+			continue;
+		envp[n++] = *e;
+	}
+
+	l->pid = launch((char *const *)cmd, envp, -1, STDERR_FILENO, 1);
+	free(envp);
+	if (l->pid < 0) {
+		wlr_xdg_activation_token_v1_destroy(token);
+		free(l);
+		return NULL;
 	}
+
+	l->token = token;
+	token->data = l;
+	LISTEN(&token->events.destroy, &l->destroy, destroylaunch);
+	wl_list_insert(&launches, &l->link);
+	return l;
 }
 
 void
@@ -2383,6 +4695,67 @@ startdrag(struct wl_listener *listener, void *data)
 	LISTEN_STATIC(&drag->icon->events.destroy, destroydragicon);
 }
 
+void
+stepclock(void)
+{
+	/* Move the virtual clock to the next timer, key repeat or output frame
+	 * due before the target, or to the target, and run whatever is due */
+	uint64_t next = clock_target, due;
+	Timer *t;
+	Keyboard *kb;
+	Monitor *m;
+	int rate;
+
+	wl_list_for_each(t, &timers, link)
+		if (t->due && t->due < next)
+			next = t->due;
+	wl_list_for_each(kb, &keyboards, link)
+		if (kb->nsyms && (rate = kb->wlr_keyboard->repeat_info.rate) > 0
+				&& (due = kb->repeat_start + kb->repeat_n * 1000000000ull / rate) < next)
+			next = due;
+	wl_list_for_each(m, &mons, link)
+		if (m->wlr_output->enabled && m->frame_due < next)
+			next = m->frame_due;
+	virtual_now = MAX(virtual_now, next);
+
+	wl_list_for_each(t, &timers, link) {
+		if (t->due && t->due <= virtual_now) {
+			t->due = 0;
+			t->func(t->data);
+		}
+	}
+	wl_list_for_each(kb, &keyboards, link)
+		if (kb->nsyms && (rate = kb->wlr_keyboard->repeat_info.rate) > 0
+				&& kb->repeat_start + kb->repeat_n * 1000000000ull / rate <= virtual_now)
+			keyrepeat(-1, 0, kb);
+	wl_list_for_each(m, &mons, link) {
+		if (!m->wlr_output->enabled || m->frame_due > virtual_now)
+			continue;
+		/* Outputs refresh on a fixed schedule, refresh is in mHz */
+		m->frame_due = (m->frame_due ? m->frame_due : virtual_now) + 1000000000000ull
+			/ (m->wlr_output->refresh > 0 ? m->wlr_output->refresh : 60000);
+		/* Delivered by the backend once it is done with the last one */
+		m->virtual_frame = 1;
+		wlr_output_schedule_frame(m->wlr_output);
+	}
+}
+
+void
+suspendscene(int suspend)
+{
+	/* Only LyrBlock can be seen while locked, so don't render the rest or
+	 * send it frame callbacks, and let clients know they can stop drawing */
+	Client *c;
+	int i;
+
+	for (i = 0; i < NUM_LAYERS; i++)
+		if (i != LyrBlock)
+			wlr_scene_node_set_enabled(&layers[i]->node, !suspend);
+	wl_list_for_each(c, &clients, link)
+		client_set_suspended(c, suspend || !VISIBLEON(c, c->mon));
+	updateidleinhibitors(NULL, 0);
+}
+
 void
 tag(const Arg *arg)
 {
@@ -2404,10 +4777,55 @@ tagmon(const Arg *arg)
 		setmon(sel, dirtomon(arg->i), 0);
 }
 
+void
+thawall(void)
+{
+	/* Async-signal-safe, for crash() and die(): whatever dwl froze must not
+	 * stay frozen once it is gone */
+	Frozen *f;
+	for (f = frozen; f < frozen + LENGTH(frozen); f++) {
+		if (!f->pid)
+			continue;
+		if (f->fd < 0 || write(f->fd, "0", 1) != 1)
+			kill(f->pid, SIGCONT);
+	}
+}
+
+void
+thawclient(Client *c)
+{
+	char cgroup[PATH_MAX];
+	Client *o;
+	pid_t pid = client_get_pid(c);
+	int incgroup = c->frozen == FreezeCgroup && !getcgroup(pid, cgroup, sizeof(cgroup));
+
+	thawprocess(pid);
+	wl_list_for_each(o, &clients, link)
+		if (o->frozen && sharesprocess(o, pid, incgroup ? cgroup : NULL))
+			o->frozen = 0;
+	c->frozen = 0;
+}
+
+void
+thawprocess(pid_t pid)
+{
+	Frozen *f;
+	for (f = frozen; f < frozen + LENGTH(frozen); f++) {
+		if (!pid || f->pid != pid)
+			continue;
+		if (f->fd < 0 || write(f->fd, "0", 1) != 1)
+			kill(pid, SIGCONT);
+		if (f->fd >= 0)
+			close(f->fd);
+		f->pid = 0;
+	}
+}
+
 void
 tile(Monitor *m)
 {
-	unsigned int i, n = 0, mw, my, ty;
+	unsigned int i = 0, n = 0;
+	struct wlr_box *tmp;
 	Client *c;
 
 	wl_list_for_each(c, &clients, link)
@@ -2416,24 +4834,42 @@ tile(Monitor *m)
 	if (n == 0)
 		return;
 
-	if (n > m->nmaster)
-		mw = m->nmaster ? m->w.width * m->mfact : 0;
+	/* Only grows, as arrange() runs on every tag switch and map */
+	if (n > tile_size) {
+		if (!(tmp = realloc(tile_geom, MAX(n, tile_size * 2) * sizeof(*tmp))))
+			die("realloc:");
+		tile_geom = tmp;
+		tile_size = MAX(n, tile_size * 2);
+	}
+	tilegeom(m->w, m->mfact, m->nmaster, n, tile_geom);
+	wl_list_for_each(c, &clients, link)
+		if (VISIBLEON(c, m) && !c->isfloating && !c->isfullscreen)
+			resize(c, tile_geom[i++], 0);
+}
+
+void
+tilegeom(struct wlr_box area, double mfact, int nmaster,
+		unsigned int n, struct wlr_box *geom)
+{
+	/* Geometry of the n tiled clients of tile(), in order. This only does
+	 * math, so it can be used and measured without a compositor. The
+	 * MAX(1, ...) matches the minimum size resize() applies. */
+	unsigned int i, mw, my = 0, ty = 0;
+
+	if (n > nmaster)
+		mw = nmaster ? area.width * mfact : 0;
 	else
-		mw = m->w.width;
-	i = my = ty = 0;
-	wl_list_for_each(c, &clients, link) {
-		if (!VISIBLEON(c, m) || c->isfloating || c->isfullscreen)
-			continue;
-		if (i < m->nmaster) {
-			resize(c, (struct wlr_box){.x = m->w.x, .y = m->w.y + my, .width = mw,
-				.height = (m->w.height - my) / (MIN(n, m->nmaster) - i)}, 0);
-			my += c->geom.height;
+		mw = area.width;
+	for (i = 0; i < n; i++) {
+		if (i < nmaster) {
+			geom[i] = (struct wlr_box){.x = area.x, .y = area.y + my, .width = mw,
+				.height = (area.height - my) / (MIN(n, nmaster) - i)};
+			my += MAX(1, geom[i].height);
 		} else {
-			resize(c, (struct wlr_box){.x = m->w.x + mw, .y = m->w.y + ty,
-				.width = m->w.width - mw, .height = (m->w.height - ty) / (n - i)}, 0);
-			ty += c->geom.height;
+			geom[i] = (struct wlr_box){.x = area.x + mw, .y = area.y + ty,
+				.width = area.width - mw, .height = (area.height - ty) / (n - i)};
+			ty += MAX(1, geom[i].height);
 		}
-		i++;
 	}
 }
 
@@ -2499,6 +4935,7 @@ unmaplayersurfacenotify(struct wl_listener *listener, void *data)
 
 	layersurface->mapped = 0;
 	wlr_scene_node_set_enabled(&layersurface->scene->node, 0);
+	updateidleinhibitors(layersurface->layer_surface->surface, 1);
 	if (layersurface == exclusive_focus)
 		exclusive_focus = NULL;
 	if (layersurface->layer_surface->output
@@ -2510,11 +4947,23 @@ unmaplayersurfacenotify(struct wl_listener *listener, void *data)
 	motionnotify(0);
 }
 
+void
+unhold(Held *h)
+{
+	if (h->destroy.notify)
+		wl_list_remove(&h->destroy.link);
+	h->destroy.notify = NULL;
+	h->ptr = NULL;
+	h->held = 0;
+}
+
 void
 unmapnotify(struct wl_listener *listener, void *data)
 {
 	/* Called when the surface is unmapped, and should no longer be shown. */
 	Client *c = wl_container_of(listener, c, unmap);
+	uint64_t start = monotime();
+	flight(FlightUnmap, 0, 0, client_get_appid(c));
 	if (c == grabc) {
 		cursor_mode = CurNormal;
 		grabc = NULL;
@@ -2526,14 +4975,65 @@ unmapnotify(struct wl_listener *listener, void *data)
 		if (client_surface(c) == seat->keyboard_state.focused_surface)
 			focusclient(focustop(selmon), 1);
 	} else {
+		if (c->frozen)
+			thawclient(c);
+		c->hiddensince = 0;
 		wl_list_remove(&c->link);
 		setmon(c, NULL, 0);
 		wl_list_remove(&c->flink);
+		c->isunresponsive = 0;
 	}
 
+	updateidleinhibitors(client_surface(c), 1);
 	wlr_scene_node_destroy(&c->scene->node);
 	printstatus();
 	motionnotify(0);
+	histadd(&unmap_time, (monotime() - start) / 1000);
+}
+
+int
+unthrottle(void *data)
+{
+	/* A new accounting window has started, catch up on what was held back */
+	Peer *p;
+	Monitor *m;
+	wl_list_for_each(p, &peers, link) {
+		p->throttled = 0;
+		applyheld(p);
+	}
+	wl_list_for_each(m, &mons, link)
+		wlr_output_schedule_frame(m->wlr_output);
+	if (status_deferred) {
+		status_deferred = 0;
+		printstatus();
+	}
+	return 0;
+}
+
+void
+updateidleinhibitors(struct wlr_surface *root, int unmapping)
+{
+	/* Update the visibility of the inhibitors of root (or of all, if NULL)
+	 * after it changed, and tell the idle notifier when none is left or the
+	 * first one appears. The scene tree of an unmapping root is going away. */
+	Inhibitor *inhibitor;
+	struct wlr_surface *surface;
+	struct wlr_scene_tree *tree;
+	int visible, was = ninhibiting, unused_lx, unused_ly;
+
+	wl_list_for_each(inhibitor, &inhibitors, link) {
+		surface = wlr_surface_get_root_surface(inhibitor->inhibitor->surface);
+		if (root && surface != root)
+			continue;
+		tree = surface->data;
+		visible = bypass_surface_visibility || (!unmapping && surface->mapped
+				&& (!tree || wlr_scene_node_coords(&tree->node, &unused_lx, &unused_ly)));
+		ninhibiting += visible - inhibitor->visible;
+		inhibitor->visible = visible;
+	}
+
+	if (!was != !ninhibiting)
+		wlr_idle_notifier_v1_set_inhibited(idle_notifier, ninhibiting > 0);
 }
 
 void
@@ -2558,6 +5058,7 @@ updatemons(struct wl_listener *listener, void *data)
 			continue;
 		config_head = wlr_output_configuration_head_v1_create(config, m->wlr_output);
 		config_head->state.enabled = 0;
+		flight(FlightOutputGone, 0, 0, m->wlr_output->name);
 		/* Remove this output from the layout to avoid cursor enter inside it */
 		wlr_output_layout_remove(output_layout, m->wlr_output);
 		closemon(m);
@@ -2584,6 +5085,7 @@ updatemons(struct wl_listener *listener, void *data)
 		/* Get the effective monitor geometry to use for surfaces */
 		wlr_output_layout_get_box(output_layout, m->wlr_output, &m->m);
 		m->w = m->m;
+		flight(FlightOutput, m->m.width, m->m.height, m->wlr_output->name);
 		wlr_scene_output_set_position(m->scene_output, m->m.x, m->m.y);
 
 		wlr_scene_node_set_position(&m->fullscreen_bg->node, m->m.x, m->m.y);
@@ -2637,23 +5139,66 @@ void
 updatetitle(struct wl_listener *listener, void *data)
 {
 	Client *c = wl_container_of(listener, c, set_title);
-	if (c == focustop(c->mon))
-		printstatus();
+	struct wlr_surface *surface = client_surface(c);
+	Peer *p = surface ? getpeer(wl_resource_get_client(surface->resource)) : NULL;
+	uint64_t cpu = cputime();
+	if (c == focustop(c->mon)) {
+		if (p && p->throttled) {
+			status_deferred = 1;
+			status_held++;
+		} else {
+			printstatus();
+		}
+	}
+	account(HandlerTitle, cpu, p ? p->client : NULL);
 }
 
 void
 urgent(struct wl_listener *listener, void *data)
 {
 	struct wlr_xdg_activation_v1_request_activate_event *event = data;
-	Client *c = NULL;
-	toplevel_from_wlr_surface(event->surface, &c, NULL);
-	if (!c || c == focustop(selmon))
+	Peer *p = getpeer(wl_resource_get_client(event->surface->resource));
+	if (p && p->throttled)
+		hold(&p->activation, event->surface, &event->surface->events.destroy);
+	else
+		seturgent(event->surface, event->token);
+}
+
+void
+usepool(const Arg *arg)
+{
+	/* Show an instance of the pool for command arg->v on the current tags
+	 * and start its replacement, or spawn the command if none is ready */
+	const Pool *p;
+	Client *c;
+
+	for (p = pools; p < END(pools); p++)
+		if (p->cmd == arg->v && p->count)
+			break;
+	if (p == END(pools) || !selmon) {
+		spawn(arg);
 		return;
+	}
 
-	if (client_surface(c)->mapped)
-		client_set_border_color(c, urgentcolor);
-	c->isurgent = 1;
+	wl_list_for_each(c, &clients, link)
+		if (c->pool == p)
+			goto found;
+	pool_misses++;
+	spawn(arg);
+	poolfill();
+	return;
+
+found:
+	pool_hits++;
+	c->pool = NULL;
+	if (c->mon != selmon)
+		setmon(c, selmon, selmon->tagset[selmon->seltags]);
+	else
+		c->tags = selmon->tagset[selmon->seltags];
+	focusclient(c, 1);
+	arrange(selmon);
 	printstatus();
+	poolfill();
 }
 
 void
@@ -2747,6 +5292,14 @@ zoom(const Arg *arg)
 }
 
 #ifdef XWAYLAND
+void
+ackconfigurex11(Client *c)
+{
+	/* Answer the configure requests of a tiled client, see configurex11() */
+	c->configurepending = 0;
+	client_set_size(c, c->geom.width - 2 * c->bw, c->geom.height - 2 * c->bw);
+}
+
 void
 activatex11(struct wl_listener *listener, void *data)
 {
@@ -2771,13 +5324,35 @@ configurex11(struct wl_listener *listener, void *data)
 {
 	Client *c = wl_container_of(listener, c, configure);
 	struct wlr_xwayland_surface_configure_event *event = data;
-	if (!c->mon)
+	/* Not managed yet, let it have what it asks for */
+	if (!c->mon) {
+		wlr_xwayland_surface_configure(c->surface.xwayland,
+				event->x, event->y, event->width, event->height);
 		return;
-	if (c->isfloating || c->type == X11Unmanaged)
+	}
+	if (c->isfloating || c->type == X11Unmanaged) {
 		resize(c, (struct wlr_box){.x = event->x, .y = event->y,
 				.width = event->width, .height = event->height}, 0);
-	else
-		arrange(c->mon);
+		return;
+	}
+
+	/* A tiled client can't change its geometry, so just tell it again what
+	 * it is. Some clients answer every configure with another request, so
+	 * do it once per frame instead of for each request. */
+	c->nconfigure++;
+	/* A disabled output has no frames to wait for */
+	if (!c->mon->wlr_output->enabled) {
+		ackconfigurex11(c);
+		return;
+	}
+	if (c->configurepending) {
+		if (++c->ncoalesced == 1000)
+			wlr_log(WLR_INFO, "X11 client %s keeps asking to be configured",
+					client_get_appid(c) ? client_get_appid(c) : broken);
+		return;
+	}
+	c->configurepending = 1;
+	wlr_output_schedule_frame(c->mon->wlr_output);
 }
 
 void
@@ -2791,6 +5366,8 @@ createnotifyx11(struct wl_listener *listener, void *data)
 	c->surface.xwayland = xsurface;
 	c->type = xsurface->override_redirect ? X11Unmanaged : X11Managed;
 	c->bw = borderpx;
+	nxclients++;
+	settimer(&xwayland_timer, 0);
 
 	/* Listen to the various events it can emit */
 	LISTEN(&xsurface->events.associate, &c->associate, associatex11);
@@ -2801,6 +5378,7 @@ createnotifyx11(struct wl_listener *listener, void *data)
 	LISTEN(&xsurface->events.set_title, &c->set_title, updatetitle);
 	LISTEN(&xsurface->events.destroy, &c->destroy, destroynotify);
 	LISTEN(&xsurface->events.request_fullscreen, &c->fullscreen, fullscreennotify);
+	LISTEN(&xsurface->events.ping_timeout, &c->ping_timeout, pingtimeout);
 }
 
 void
@@ -2811,19 +5389,6 @@ dissociatex11(struct wl_listener *listener, void *data)
 	wl_list_remove(&c->unmap.link);
 }
 
-xcb_atom_t
-getatom(xcb_connection_t *xc, const char *name)
-{
-	xcb_atom_t atom = 0;
-	xcb_intern_atom_reply_t *reply;
-	xcb_intern_atom_cookie_t cookie = xcb_intern_atom(xc, 0, strlen(name), name);
-	if ((reply = xcb_intern_atom_reply(xc, cookie, NULL)))
-		atom = reply->atom;
-	free(reply);
-
-	return atom;
-}
-
 void
 sethints(struct wl_listener *listener, void *data)
 {
@@ -2840,23 +5405,80 @@ sethints(struct wl_listener *listener, void *data)
 	printstatus();
 }
 
+void
+xwaylanddisconnect(void)
+{
+	if (xwayland_query)
+		wl_event_source_remove(xwayland_query);
+	xwayland_query = NULL;
+	if (xwayland_xc)
+		xcb_disconnect(xwayland_xc);
+	xwayland_xc = NULL;
+}
+
+int
+xwaylandidle(void *data)
+{
+	/* No X11 windows for xwayland_timeout seconds, stop the server if no
+	 * windowless clients (xrdb, xclip...) are connected either. wlroots
+	 * keeps listening on DISPLAY and starts it again on demand, which runs
+	 * xwaylandready() again. The clients are asked for without waiting,
+	 * see xwaylandreply(). */
+	if (nxclients || xwayland_query || !xwayland_xc || !xwayland->server
+			|| xwayland->server->pid <= 0)
+		return 0;
+	if (xcb_connection_has_error(xwayland_xc)) {
+		xwaylanddisconnect();
+		return 0;
+	}
+	wm_cookie = xcb_get_selection_owner(xwayland_xc, wm_s0);
+	clients_cookie = xcb_res_query_clients(xwayland_xc);
+	xcb_flush(xwayland_xc);
+	xwayland_query = wl_event_loop_add_fd(wl_display_get_event_loop(dpy),
+			xcb_get_file_descriptor(xwayland_xc), WL_EVENT_READABLE, xwaylandreply, NULL);
+	/* The replies may already have been read while flushing */
+	return xwaylandreply(-1, 0, NULL);
+}
+
 void
 xwaylandready(struct wl_listener *listener, void *data)
 {
+	static const char *const atomnames[NetLast] = {
+		[NetWMWindowTypeDialog] = "_NET_WM_WINDOW_TYPE_DIALOG",
+		[NetWMWindowTypeSplash] = "_NET_WM_WINDOW_TYPE_SPLASH",
+		[NetWMWindowTypeToolbar] = "_NET_WM_WINDOW_TYPE_TOOLBAR",
+		[NetWMWindowTypeUtility] = "_NET_WM_WINDOW_TYPE_UTILITY",
+	};
+	xcb_intern_atom_cookie_t cookies[NetLast], wm_s0_cookie;
+	xcb_intern_atom_reply_t *reply;
 	struct wlr_xcursor *xcursor;
-	xcb_connection_t *xc = xcb_connect(xwayland->display_name, NULL);
-	int err = xcb_connection_has_error(xc);
-	if (err) {
+	xcb_connection_t *xc;
+	int i, err;
+
+	/* The connection is kept for xwaylandidle(), replacing the one to the
+	 * previous server, if any */
+	xwaylanddisconnect();
+	xc = xcb_connect(xwayland->display_name, NULL);
+	if ((err = xcb_connection_has_error(xc))) {
 		fprintf(stderr, "xcb_connect to X server failed with code %d\n. Continuing with degraded functionality.\n", err);
+		xcb_disconnect(xc);
 		return;
 	}
 
-	/* Collect atoms we are interested in. If getatom returns 0, we will
-	 * not detect that window type. */
-	netatom[NetWMWindowTypeDialog] = getatom(xc, "_NET_WM_WINDOW_TYPE_DIALOG");
-	netatom[NetWMWindowTypeSplash] = getatom(xc, "_NET_WM_WINDOW_TYPE_SPLASH");
-	netatom[NetWMWindowTypeToolbar] = getatom(xc, "_NET_WM_WINDOW_TYPE_TOOLBAR");
-	netatom[NetWMWindowTypeUtility] = getatom(xc, "_NET_WM_WINDOW_TYPE_UTILITY");
+	/* Collect atoms we are interested in, sending all requests before
+	 * waiting for the replies. If an atom is 0, we will not detect that
+	 * window type. */
+	for (i = 0; i < NetLast; i++)
+		cookies[i] = xcb_intern_atom(xc, 0, strlen(atomnames[i]), atomnames[i]);
+	wm_s0_cookie = xcb_intern_atom(xc, 0, strlen("WM_S0"), "WM_S0");
+	for (i = 0; i < NetLast; i++) {
+		reply = xcb_intern_atom_reply(xc, cookies[i], NULL);
+		netatom[i] = reply ? reply->atom : 0;
+		free(reply);
+	}
+	reply = xcb_intern_atom_reply(xc, wm_s0_cookie, NULL);
+	wm_s0 = reply ? reply->atom : 0;
+	free(reply);
 
 	/* assign the one and only seat */
 	wlr_xwayland_set_seat(xwayland, seat);
@@ -2868,7 +5490,81 @@ xwaylandready(struct wl_listener *listener, void *data)
 				xcursor->images[0]->width, xcursor->images[0]->height,
 				xcursor->images[0]->hotspot_x, xcursor->images[0]->hotspot_y);
 
-	xcb_disconnect(xc);
+	xwayland_xc = xc;
+
+	/* Started by a client that may not map anything */
+	if (!nxclients && xwayland_idle)
+		settimer(&xwayland_timer, xwayland_idle);
+}
+
+int
+xwaylandreply(int fd, uint32_t mask, void *data)
+{
+	/* Xwayland is idle if every client it lists is one we know: the server
+	 * itself (resource base 0), our connection and the window manager of
+	 * wlroots, which owns WM_S0. */
+	static xcb_get_selection_owner_reply_t *wm;
+	static xcb_res_query_clients_reply_t *clients;
+	static int gotwm, gotclients;
+	xcb_res_client_iterator_t it;
+	uint32_t ours = xcb_get_setup(xwayland_xc)->resource_id_base;
+	unsigned int others = 0;
+	void *reply;
+
+	if (!gotwm && xcb_poll_for_reply(xwayland_xc, wm_cookie.sequence, &reply, NULL)) {
+		wm = reply;
+		gotwm = 1;
+	}
+	if (!gotclients && xcb_poll_for_reply(xwayland_xc, clients_cookie.sequence, &reply, NULL)) {
+		clients = reply;
+		gotclients = 1;
+	}
+	if ((!gotwm || !gotclients) && !xcb_connection_has_error(xwayland_xc))
+		return 0;
+
+	if (clients) {
+		for (it = xcb_res_query_clients_clients_iterator(clients); it.rem;
+				xcb_res_client_next(&it))
+			if (it.data->resource_base && it.data->resource_base != ours
+					&& (!wm || (wm->owner & ~it.data->resource_mask)
+						!= it.data->resource_base))
+				others++;
+	}
+	if (clients && wm && wm->owner && !others && !nxclients
+			&& xwayland->server && xwayland->server->pid > 0) {
+		xwayland_stopping = xwayland->server->pid;
+		kill(xwayland_stopping, SIGTERM);
+		settimer(&xwayland_stop_timer, 5000);
+	} else if (!nxclients && xwayland_idle) {
+		settimer(&xwayland_timer, xwayland_idle);
+	}
+
+	free(wm);
+	free(clients);
+	wm = NULL;
+	clients = NULL;
+	gotwm = gotclients = 0;
+	wl_event_source_remove(xwayland_query);
+	xwayland_query = NULL;
+	if (xcb_connection_has_error(xwayland_xc))
+		xwaylanddisconnect();
+	return 0;
+}
+
+int
+xwaylandstopped(void *data)
+{
+	/* wlroots clears the pid once the server is gone */
+	if (xwayland->server && xwayland->server->pid == xwayland_stopping) {
+		wlr_log(WLR_ERROR, "Xwayland (pid %d) ignored SIGTERM, killing it",
+				(int)xwayland_stopping);
+		kill(xwayland_stopping, SIGKILL);
+		xwayland_kills++;
+	} else {
+		xwayland_stops++;
+	}
+	xwayland_stopping = 0;
+	return 0;
 }
 #endif
 
@@ -2878,18 +5574,33 @@ main(int argc, char *argv[])
 	char *startup_cmd = NULL;
 	int c;
 
-	while ((c = getopt(argc, argv, "s:hdv")) != -1) {
+	while ((c = getopt(argc, argv, "s:r:R:fc:hdv")) != -1) {
 		if (c == 's')
 			startup_cmd = optarg;
+		else if (c == 'r')
+			record_file = fopen(optarg, "we");
+		else if (c == 'R')
+			replay_file = fopen(optarg, "re");
+		else if (c == 'f')
+			replay_fast = 1;
+		else if (c == 'c')
+			clock_fd = atoi(optarg);
 		else if (c == 'd')
 			log_level = WLR_DEBUG;
 		else if (c == 'v')
 			die("dwl " VERSION);
 		else
 			goto usage;
+		if ((c == 'r' && !record_file) || (c == 'R' && !replay_file))
+			die("cannot open %s:", optarg);
+		/* Programs we start should not eat our clock */
+		if (c == 'c' && fcntl(clock_fd, F_SETFD, FD_CLOEXEC) < 0)
+			die("cannot use clock fd %s:", optarg);
 	}
 	if (optind < argc)
 		goto usage;
+	if (clock_fd >= 0)
+		clock_target = virtual_now = monotime();
 
 	/* Wayland requires XDG_RUNTIME_DIR for creating its communications socket */
 	if (!getenv("XDG_RUNTIME_DIR"))
@@ -2900,5 +5611,5 @@ main(int argc, char *argv[])
 	return EXIT_SUCCESS;
 
 usage:
-	die("Usage: %s [-v] [-d] [-s startup command]", argv[0]);
+	die("Usage: %s [-v] [-d] [-c clock fd] [-r record file] [-R replay file [-f]] [-s startup command]", argv[0]);
 }
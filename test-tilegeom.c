@@ -0,0 +1,74 @@
+/*
+ * See LICENSE file for copyright and license details.
+ *
+ * test-tilegeom - checks the boxes tilegeom() gives for known layouts and
+ * measures its time per client, see "make check"
+ */
+#define main dwlmain
+#include "dwl.c"
+#undef main
+
+#define NCLIENTS 10000
+#define NRUNS    100
+
+typedef struct {
+	const char *name;
+	struct wlr_box area;
+	double mfact;
+	int nmaster;
+	unsigned int n;
+	struct wlr_box want[4];
+} Layout;
+
+static const Layout layouts[] = {
+	{"one master, two stacked", {0, 0, 1000, 600}, 0.55, 1, 3,
+		{{0, 0, 550, 600}, {550, 0, 450, 300}, {550, 300, 450, 300}}},
+	{"single client", {0, 0, 1000, 600}, 0.55, 1, 1,
+		{{0, 0, 1000, 600}}},
+	/* The remainder goes to the last client of each column */
+	{"uneven heights", {0, 0, 1000, 100}, 0.5, 1, 4,
+		{{0, 0, 500, 100}, {500, 0, 500, 33}, {500, 33, 500, 33}, {500, 66, 500, 34}}},
+	{"offset area, two masters", {10, 20, 800, 600}, 0.5, 2, 3,
+		{{10, 20, 400, 300}, {10, 320, 400, 300}, {410, 20, 400, 600}}},
+	/* No master area: everything is stacked over the whole width */
+	{"nmaster 0", {0, 0, 1000, 600}, 0.55, 0, 2,
+		{{0, 0, 1000, 300}, {0, 300, 1000, 300}}},
+	/* Fewer clients than nmaster: masters take the whole width */
+	{"n < nmaster", {0, 0, 1000, 600}, 0.55, 3, 2,
+		{{0, 0, 1000, 300}, {0, 300, 1000, 300}}},
+	{"no clients", {0, 0, 1000, 600}, 0.55, 1, 0, {{0}}},
+};
+
+int
+main(void)
+{
+	static struct wlr_box geom[NCLIENTS];
+	const Layout *l;
+	struct wlr_box *b;
+	uint64_t start;
+	unsigned int i;
+	int r, failed = 0;
+	volatile int sink = 0; /* keeps the timed calls from being optimized out */
+
+	for (l = layouts; l < layouts + LENGTH(layouts); l++) {
+		tilegeom(l->area, l->mfact, l->nmaster, l->n, geom);
+		for (i = 0; i < l->n; i++) {
+			b = &geom[i];
+			if (wlr_box_equal(b, &l->want[i]))
+				continue;
+			fprintf(stderr, "%s: client %u is %d,%d %dx%d instead of %d,%d %dx%d\n",
+					l->name, i, b->x, b->y, b->width, b->height, l->want[i].x,
+					l->want[i].y, l->want[i].width, l->want[i].height);
+			failed = 1;
+		}
+	}
+
+	start = monotime();
+	for (r = 0; r < NRUNS; r++) {
+		tilegeom((struct wlr_box){0, 0, 3840, 2160}, 0.55, r % 3, NCLIENTS, geom);
+		sink += geom[NCLIENTS - 1].height;
+	}
+	printf("tilegeom: %.2f ns per client\n",
+			(double)(monotime() - start) / NRUNS / NCLIENTS);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}